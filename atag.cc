@@ -0,0 +1,172 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Boot information (ATAGs or device tree) passed by the firmware
+ */
+
+#include <stdint.h>
+#include "atag.h"
+#include "string.h"
+
+namespace ATAG {
+    enum {
+	// default location of the ATAG list
+	DEFAULT_ADDR = 0x100,
+
+	// ATAG ids
+	ATAG_NONE = 0x00000000,
+	ATAG_CORE = 0x54410001,
+	ATAG_MEM  = 0x54410002,
+
+	// flattened device tree
+	FDT_MAGIC      = 0xd00dfeed,
+	FDT_BEGIN_NODE = 1,
+	FDT_END_NODE   = 2,
+	FDT_PROP       = 3,
+	FDT_NOP        = 4,
+	FDT_END        = 9,
+    };
+
+    struct FDTHeader {
+	uint32_t magic;
+	uint32_t totalsize;
+	uint32_t off_dt_struct;
+	uint32_t off_dt_strings;
+	uint32_t off_mem_rsvmap;
+	uint32_t version;
+	uint32_t last_comp_version;
+	uint32_t boot_cpuid_phys;
+	uint32_t size_dt_strings;
+	uint32_t size_dt_struct;
+    };
+
+    // device tree is big-endian
+    static inline uint32_t be(uint32_t x) {
+	return __builtin_bswap32(x);
+    }
+
+    static bool equal(const char *a, const char *b) {
+	while (*a && *a == *b) {
+	    ++a;
+	    ++b;
+	}
+	return *a == *b;
+    }
+
+    // node names are "memory" or "memory@<unit address>"
+    static bool is_memory_node(const char *name) {
+	const char *m = "memory";
+	while (*m && *m == *name) {
+	    ++m;
+	    ++name;
+	}
+	return *m == 0 && (*name == 0 || *name == '@');
+    }
+
+    static uint32_t fdt_memory(const FDTHeader *fdt,
+			       Region *regions, uint32_t max) {
+	const char *base = (const char *)fdt;
+	const uint32_t *p = (const uint32_t *)(base + be(fdt->off_dt_struct));
+	const uint32_t *end = p + be(fdt->size_dt_struct) / 4;
+	const char *strings = base + be(fdt->off_dt_strings);
+	uint32_t depth = 0;
+	uint32_t address_cells = 1;
+	uint32_t size_cells = 1;
+	bool in_memory = false;
+	uint32_t count = 0;
+
+	while (p < end) {
+	    switch (be(*p++)) {
+	    case FDT_BEGIN_NODE: {
+		const char *name = (const char *)p;
+		p += (strlen(name) + 4) / 4;
+		++depth;
+		// root node is depth 1, its children depth 2
+		in_memory = (depth == 2) && is_memory_node(name);
+		break;
+	    }
+	    case FDT_END_NODE:
+		if (depth == 2) in_memory = false;
+		--depth;
+		break;
+	    case FDT_PROP: {
+		uint32_t len = be(p[0]);
+		const char *name = strings + be(p[1]);
+		const uint32_t *value = p + 2;
+		p += 2 + (len + 3) / 4;
+		if (depth == 1 && equal(name, "#address-cells")) {
+		    address_cells = be(value[0]);
+		} else if (depth == 1 && equal(name, "#size-cells")) {
+		    size_cells = be(value[0]);
+		} else if (in_memory && equal(name, "reg")) {
+		    uint32_t cells = address_cells + size_cells;
+		    if (cells == 0) break;
+		    // 32bit kernel, use the low word of each cell group
+		    for (uint32_t i = 0; i + cells <= len / 4; i += cells) {
+			if (count >= max) break;
+			regions[count].start = be(value[i + address_cells - 1]);
+			regions[count].size = be(value[i + cells - 1]);
+			++count;
+		    }
+		}
+		break;
+	    }
+	    case FDT_NOP:
+		break;
+	    case FDT_END:
+	    default:
+		return count;
+	    }
+	}
+	return count;
+    }
+
+    static uint32_t atag_memory(const uint32_t *tag,
+				Region *regions, uint32_t max) {
+	// list must start with ATAG_CORE
+	if (tag[1] != ATAG_CORE) return 0;
+	uint32_t count = 0;
+	// tag[0] = size in words, tag[1] = id
+	while (tag[0] != 0 && tag[1] != ATAG_NONE) {
+	    if (tag[1] == ATAG_MEM && count < max) {
+		regions[count].size = tag[2];
+		regions[count].start = tag[3];
+		++count;
+	    }
+	    tag += tag[0];
+	}
+	return count;
+    }
+
+    uint32_t memory(const void *atags, Region *regions, uint32_t max) {
+	if (atags == 0) atags = (const void *)DEFAULT_ADDR;
+	const FDTHeader *fdt = (const FDTHeader *)atags;
+	if (be(fdt->magic) == FDT_MAGIC) {
+	    return fdt_memory(fdt, regions, max);
+	}
+	return atag_memory((const uint32_t *)atags, regions, max);
+    }
+
+    Region fdt(const void *atags) {
+	if (atags == 0) atags = (const void *)DEFAULT_ADDR;
+	const FDTHeader *header = (const FDTHeader *)atags;
+	Region region = {(uint32_t)atags, 0};
+	if (be(header->magic) == FDT_MAGIC) region.size = be(header->totalsize);
+	return region;
+    }
+}
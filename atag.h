@@ -0,0 +1,42 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Boot information (ATAGs or device tree) passed by the firmware
+ */
+
+#ifndef KERNEL_ATAG_H
+#define KERNEL_ATAG_H 1
+
+#include <stdint.h>
+
+namespace ATAG {
+    struct Region {
+	uint32_t start;
+	uint32_t size;
+    };
+
+    // Find the ARM memory in the ATAG list or flattened device tree at
+    // atags. Fills at most max regions and returns the number found.
+    uint32_t memory(const void *atags, Region *regions, uint32_t max);
+
+    // where the flattened device tree at atags lies, size 0 for an
+    // ATAG list
+    Region fdt(const void *atags);
+}
+
+#endif // #ifndef KERNEL_ATAG_H
@@ -0,0 +1,179 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Write-back cache of SD card blocks
+ *
+ * Block data and the bounce buffer come from whole pages, so DMA to
+ * and from them never shares a cache line with anything else.
+ */
+
+#include <stdint.h>
+#include "blockcache.h"
+#include "memory.h"
+#include "string.h"
+
+namespace BlockCache {
+    enum {
+	BLOCK_SIZE = EMMC::BLOCK_SIZE,
+	DATA_PAGES = NUM_ENTRIES * BLOCK_SIZE / Memory::PAGE_SIZE,
+	BOUNCE_PAGES = BATCH * BLOCK_SIZE / Memory::PAGE_SIZE,
+    };
+
+    struct Entry {
+	uint32_t lba;
+	uint32_t last_use;
+	bool valid;
+	bool dirty;
+	uint8_t *data;
+    };
+
+    static Entry entries[NUM_ENTRIES];
+    static uint8_t *bounce;
+    static uint32_t clock;
+    static Stats counters;
+
+    EMMC::Error init(void) {
+	if (bounce) return EMMC::SUCCESS;
+	uint8_t *data = (uint8_t *)Memory::alloc_pages(DATA_PAGES);
+	uint8_t *buf = (uint8_t *)Memory::alloc_pages(BOUNCE_PAGES);
+	if (data == 0 || buf == 0) {
+	    // bounce stays 0, a retry starts over
+	    if (data) Memory::free_pages(data, DATA_PAGES);
+	    if (buf) Memory::free_pages(buf, BOUNCE_PAGES);
+	    return EMMC::FAIL_NO_MEMORY;
+	}
+	for (uint32_t i = 0; i < NUM_ENTRIES; ++i) {
+	    entries[i].valid = false;
+	    entries[i].dirty = false;
+	    entries[i].data = &data[i * BLOCK_SIZE];
+	}
+	bounce = buf;
+	return EMMC::SUCCESS;
+    }
+
+    static Entry * lookup(uint32_t lba) {
+	for (uint32_t i = 0; i < NUM_ENTRIES; ++i) {
+	    Entry &e = entries[i];
+	    if (e.valid && e.lba == lba) return &e;
+	}
+	return 0;
+    }
+
+    // write a dirty block and the dirty blocks following it
+    static EMMC::Error write_back(Entry &first) {
+	uint32_t n = 0;
+	Entry *run[BATCH];
+	for (Entry *e = &first; n < BATCH && e && e->dirty; e = lookup(e->lba + 1)) {
+	    memcpy(&bounce[n * BLOCK_SIZE], e->data, BLOCK_SIZE);
+	    run[n++] = e;
+	}
+	EMMC::Error err = EMMC::write(first.lba, n, bounce);
+	if (err != EMMC::SUCCESS) return err;
+	++counters.writes;
+	for (uint32_t i = 0; i < n; ++i) run[i]->dirty = false;
+	return EMMC::SUCCESS;
+    }
+
+    // least recently used entry, written back if needed
+    static EMMC::Error victim(Entry *&res) {
+	res = &entries[0];
+	for (uint32_t i = 0; i < NUM_ENTRIES; ++i) {
+	    Entry &e = entries[i];
+	    if (!e.valid) {
+		res = &e;
+		break;
+	    }
+	    if (clock - e.last_use > clock - res->last_use) res = &e;
+	}
+	if (res->valid && res->dirty) return write_back(*res);
+	return EMMC::SUCCESS;
+    }
+
+    static EMMC::Error insert(uint32_t lba, const uint8_t *data, bool dirty) {
+	Entry *e = lookup(lba);
+	if (!e) {
+	    EMMC::Error err = victim(e);
+	    if (err != EMMC::SUCCESS) return err;
+	    e->lba = lba;
+	    e->valid = true;
+	    e->dirty = false;
+	}
+	memcpy(e->data, data, BLOCK_SIZE);
+	e->dirty = e->dirty || dirty;
+	e->last_use = ++clock;
+	return EMMC::SUCCESS;
+    }
+
+    EMMC::Error read(uint32_t lba, uint32_t count, void *buf) {
+	uint8_t *out = (uint8_t *)buf;
+	uint32_t i = 0;
+	while (i < count) {
+	    Entry *e = lookup(lba + i);
+	    if (e) {
+		memcpy(&out[i * BLOCK_SIZE], e->data, BLOCK_SIZE);
+		e->last_use = ++clock;
+		++counters.hits;
+		++i;
+		continue;
+	    }
+	    // the run of misses in one transfer
+	    uint32_t n = 1;
+	    while (i + n < count && n < BATCH && !lookup(lba + i + n)) ++n;
+	    EMMC::Error err = EMMC::read(lba + i, n, bounce);
+	    if (err != EMMC::SUCCESS) return err;
+	    ++counters.reads;
+	    counters.misses += n;
+	    // out first, evictions reuse the bounce buffer
+	    memcpy(&out[i * BLOCK_SIZE], bounce, n * BLOCK_SIZE);
+	    for (uint32_t k = 0; k < n; ++k, ++i) {
+		err = insert(lba + i, &out[i * BLOCK_SIZE], false);
+		if (err != EMMC::SUCCESS) return err;
+	    }
+	}
+	return EMMC::SUCCESS;
+    }
+
+    EMMC::Error write(uint32_t lba, uint32_t count, const void *buf) {
+	const uint8_t *in = (const uint8_t *)buf;
+	for (uint32_t i = 0; i < count; ++i) {
+	    EMMC::Error err = insert(lba + i, &in[i * BLOCK_SIZE], true);
+	    if (err != EMMC::SUCCESS) return err;
+	}
+	return EMMC::SUCCESS;
+    }
+
+    EMMC::Error flush(void) {
+	while (true) {
+	    // lowest dirty block first, so runs start at their beginning
+	    Entry *first = 0;
+	    for (uint32_t i = 0; i < NUM_ENTRIES; ++i) {
+		Entry &e = entries[i];
+		if (e.valid && e.dirty && (!first || e.lba < first->lba)) {
+		    first = &e;
+		}
+	    }
+	    if (!first) return EMMC::SUCCESS;
+	    EMMC::Error err = write_back(*first);
+	    if (err != EMMC::SUCCESS) return err;
+	}
+    }
+
+    void stats(Stats &res) {
+	res = counters;
+    }
+}
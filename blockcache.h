@@ -0,0 +1,57 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Write-back cache of SD card blocks
+ *
+ * Misses are read in runs of up to BATCH blocks, writes only mark the
+ * cached blocks dirty. Dirty blocks go to the card when evicted or on
+ * flush(), runs of neighbours together. One caller at a time.
+ */
+
+#ifndef KERNEL_BLOCKCACHE_H
+#define KERNEL_BLOCKCACHE_H 1
+
+#include <stdint.h>
+#include "emmc.h"
+
+namespace BlockCache {
+    enum {
+	NUM_ENTRIES = 128,
+	BATCH = 16, // blocks per transfer at most
+    };
+
+    struct Stats {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t reads;  // transfers from the card
+	uint32_t writes; // transfers to the card
+    };
+
+    // allocate the cache, needs EMMC::init()
+    EMMC::Error init(void);
+
+    // any buffer alignment
+    EMMC::Error read(uint32_t lba, uint32_t count, void *buf);
+    EMMC::Error write(uint32_t lba, uint32_t count, const void *buf);
+    // write all dirty blocks
+    EMMC::Error flush(void);
+
+    void stats(Stats &stats);
+}
+
+#endif // #ifndef KERNEL_BLOCKCACHE_H
@@ -0,0 +1,63 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Boot phase timestamps for the Raspberry Pi
+ *
+ * The system timer runs at 1MHz from power on, so it works before
+ * anything is initialized.
+ */
+
+#include <stdint.h>
+#include "boottime.h"
+#include "peripherals.h"
+#include "stdio.h"
+
+extern "C" {
+    // in .data, boot.S writes the first two before the BSS is cleared
+    uint32_t boot_stamps[BootTime::NUM_PHASES]
+    __attribute__((section(".data")));
+}
+
+namespace BootTime {
+    enum {
+	// system timer counter, lower 32 bits
+	SYSTEM_TIMER_CLO = 0x3004,
+    };
+
+    static const char *names[NUM_PHASES] = {
+	"entry", "bss", "uart", "framebuffer", "memory", "mmu", "smp",
+	"first pixel",
+    };
+
+    void mark(Phase phase) {
+	if (boot_stamps[phase] != 0) return;
+	boot_stamps[phase] = *Peripherals::reg(SYSTEM_TIMER_CLO);
+    }
+
+    void print(void) {
+	uint32_t start = boot_stamps[ENTRY];
+	uint32_t last = start;
+	puts("phase             us   delta\n");
+	for (uint32_t i = 0; i < NUM_PHASES; ++i) {
+	    if (boot_stamps[i] == 0) continue;
+	    printf("%-12s%8lu%8lu\n", names[i], boot_stamps[i] - start,
+		   boot_stamps[i] - last);
+	    last = boot_stamps[i];
+	}
+    }
+}
@@ -0,0 +1,139 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Data cache maintenance for the Raspberry Pi 2
+ */
+
+#include <stdint.h>
+#include "cache.h"
+#include "barriers.h"
+
+namespace Cache {
+    // maintenance operations by set/way
+    enum SetWayOp { INVALIDATE, CLEAN, CLEAN_INVALIDATE };
+
+    uint32_t line_size(void) {
+	uint32_t ctr;
+	// CTR, DminLine is log2 of the number of words
+	asm volatile("mrc p15, 0, %0, c0, c0, 1" : "=r" (ctr));
+	return 4 << ((ctr >> 16) & 0xF);
+    }
+
+    void clean_range(const volatile void *addr, uint32_t size) {
+	uint32_t line = line_size();
+	uint32_t start = (uint32_t)addr & ~(line - 1);
+	uint32_t end = (uint32_t)addr + size;
+	data_sync_barrier();
+	for (uint32_t p = start; p < end; p += line) {
+	    // DCCMVAC
+	    asm volatile("mcr p15, 0, %0, c7, c10, 1" :: "r" (p));
+	}
+	data_sync_barrier();
+    }
+
+    void invalidate_range(const volatile void *addr, uint32_t size) {
+	uint32_t line = line_size();
+	uint32_t start = (uint32_t)addr;
+	uint32_t end = start + size;
+	data_sync_barrier();
+	if (start & (line - 1)) {
+	    start &= ~(line - 1);
+	    // DCCIMVAC, keep the data before the buffer
+	    asm volatile("mcr p15, 0, %0, c7, c14, 1" :: "r" (start));
+	    start += line;
+	}
+	if (end & (line - 1)) {
+	    end &= ~(line - 1);
+	    // DCCIMVAC, keep the data after the buffer
+	    asm volatile("mcr p15, 0, %0, c7, c14, 1" :: "r" (end));
+	}
+	for (uint32_t p = start; p < end; p += line) {
+	    // DCIMVAC
+	    asm volatile("mcr p15, 0, %0, c7, c6, 1" :: "r" (p));
+	}
+	data_sync_barrier();
+    }
+
+    void clean_invalidate_range(const volatile void *addr, uint32_t size) {
+	uint32_t line = line_size();
+	uint32_t start = (uint32_t)addr & ~(line - 1);
+	uint32_t end = (uint32_t)addr + size;
+	data_sync_barrier();
+	for (uint32_t p = start; p < end; p += line) {
+	    // DCCIMVAC
+	    asm volatile("mcr p15, 0, %0, c7, c14, 1" :: "r" (p));
+	}
+	data_sync_barrier();
+    }
+
+    static void set_way(SetWayOp op) {
+	uint32_t clidr;
+	asm volatile("mrc p15, 1, %0, c0, c0, 1" : "=r" (clidr));
+	// level of coherency
+	uint32_t loc = (clidr >> 24) & 7;
+	data_sync_barrier();
+	for (uint32_t level = 0; level < loc; ++level) {
+	    uint32_t type = (clidr >> (level * 3)) & 7;
+	    // 0 no cache, 1 instruction only
+	    if (type < 2) continue;
+	    uint32_t ccsidr;
+	    // CSSELR, select data / unified cache of this level
+	    asm volatile("mcr p15, 2, %0, c0, c0, 0" :: "r" (level << 1));
+	    instruction_barrier();
+	    asm volatile("mrc p15, 1, %0, c0, c0, 0" : "=r" (ccsidr));
+	    uint32_t line_shift = (ccsidr & 7) + 4;
+	    uint32_t ways = ((ccsidr >> 3) & 0x3FF) + 1;
+	    uint32_t sets = ((ccsidr >> 13) & 0x7FFF) + 1;
+	    // a direct mapped cache has no way bits
+	    uint32_t way_shift = (ways > 1) ? __builtin_clz(ways - 1) : 0;
+	    for (uint32_t way = 0; way < ways; ++way) {
+		for (uint32_t set = 0; set < sets; ++set) {
+		    uint32_t sw = way << way_shift | set << line_shift
+			| level << 1;
+		    switch (op) {
+		    case INVALIDATE: // DCISW
+			asm volatile("mcr p15, 0, %0, c7, c6, 2" :: "r" (sw));
+			break;
+		    case CLEAN: // DCCSW
+			asm volatile("mcr p15, 0, %0, c7, c10, 2" :: "r" (sw));
+			break;
+		    case CLEAN_INVALIDATE: // DCCISW
+			asm volatile("mcr p15, 0, %0, c7, c14, 2" :: "r" (sw));
+			break;
+		    }
+		}
+	    }
+	}
+	// back to the level 1 cache
+	asm volatile("mcr p15, 2, %0, c0, c0, 0" :: "r" (0));
+	data_sync_barrier();
+	instruction_barrier();
+    }
+
+    void clean_all(void) {
+	set_way(CLEAN);
+    }
+
+    void invalidate_all(void) {
+	set_way(INVALIDATE);
+    }
+
+    void clean_invalidate_all(void) {
+	set_way(CLEAN_INVALIDATE);
+    }
+}
@@ -0,0 +1,50 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Data cache maintenance for the Raspberry Pi 2
+ */
+
+#ifndef KERNEL_CACHE_H
+#define KERNEL_CACHE_H 1
+
+#include <stdint.h>
+
+namespace Cache {
+    // size of the smallest data cache line in bytes
+    uint32_t line_size(void);
+
+    /* Operations by virtual address range (point of coherency)
+     * The range is extended to whole cache lines. invalidate_range()
+     * cleans partial lines at either end first so data sharing a line
+     * with the buffer isn't lost.
+     */
+    // write dirty lines back to memory, e.g. before a device reads
+    void clean_range(const volatile void *addr, uint32_t size);
+    // drop lines, e.g. before reading what a device wrote
+    void invalidate_range(const volatile void *addr, uint32_t size);
+    void clean_invalidate_range(const volatile void *addr, uint32_t size);
+
+    /* Operations on every line of every data / unified cache level
+     * by set/way. Only meaningful for the local core.
+     */
+    void clean_all(void);
+    void invalidate_all(void);
+    void clean_invalidate_all(void);
+}
+
+#endif // #ifndef KERNEL_CACHE_H
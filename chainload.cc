@@ -0,0 +1,175 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * UART chainloader for the Raspberry Pi 2
+ *
+ * The image goes to free pages, always above LOAD_ADDR. The handover
+ * code in handover.S is copied to STUB_ADDR, or past a device tree
+ * there, and turns the MMU off before anything is overwritten.
+ */
+
+#include <stdint.h>
+#include "chainload.h"
+#include "memory.h"
+#include "atag.h"
+#include "crc.h"
+#include "uart.h"
+#include "ipi.h"
+#include "smp.h"
+#include "cache.h"
+#include "string.h"
+#include "barriers.h"
+
+// handover.S, only ever called in the copy at stub_addr
+extern "C" {
+    extern char chainload_stub[];
+    extern char chainload_park[];
+    extern char chainload_boot[];
+    extern char chainload_stub_end[];
+}
+
+namespace Chainload {
+    enum {
+	// local mailbox 3 set and read / clear registers, 16 bytes per core
+	MAILBOX3_SET = 0x4000008C,
+	MAILBOX3_CLEAR = 0x400000CC,
+	// not an entry point, a parked core clears it
+	PARK_MARK = 1,
+    };
+
+    typedef void (*park_fn)(uint32_t core);
+    typedef void (*boot_fn)(const void *image, uint32_t size,
+			    uint32_t model_id, const void *atags);
+
+    static uint32_t model;
+    static uint32_t stub_addr;
+    static const void *tags;
+    static uint8_t *image;
+    static uint32_t pages;
+    static uint32_t size;
+    static uint32_t crc;
+    static uint32_t received;
+
+    static volatile uint32_t * mailbox3_set(uint32_t core) {
+	return (volatile uint32_t *)(MAILBOX3_SET + core * 0x10);
+    }
+
+    static volatile uint32_t * mailbox3_clear(uint32_t core) {
+	return (volatile uint32_t *)(MAILBOX3_CLEAR + core * 0x10);
+    }
+
+    // address of a stub function in the copy at stub_addr
+    static uint32_t relocated(const char *fn) {
+	return stub_addr + (fn - chainload_stub);
+    }
+
+    // IPI handler on cores 1-3, IRQs are masked
+    static void on_park(uint32_t, uint32_t) {
+	park_fn park = (park_fn)relocated(chainload_park);
+	park(SMP::core_id());
+    }
+
+    void init(uint32_t model_id, const void *atags) {
+	model = model_id;
+	tags = atags;
+	// the next kernel gets the device tree too, keep clear of it
+	stub_addr = STUB_ADDR;
+	ATAG::Region fdt = ATAG::fdt(atags);
+	if (fdt.size && fdt.start < STUB_LIMIT && fdt.start + fdt.size > STUB_ADDR) {
+	    stub_addr = (fdt.start + fdt.size + 31) & ~31U;
+	}
+	IPI::set_handler(IPI::PARK, on_park);
+    }
+
+    Remote::Error begin(const Remote::Frame &frame) {
+	if (frame.length != 8) return Remote::FAIL_LENGTH;
+	if (image) {
+	    Memory::free_pages(image, pages);
+	    image = 0;
+	}
+	size = Remote::get32(&frame.payload[0]);
+	crc = Remote::get32(&frame.payload[4]);
+	received = 0;
+	if (size == 0 || size > MAX_IMAGE) return Remote::FAIL_INVALID_VALUE;
+	// chainload_boot() copies whole 32 byte blocks, pages are enough
+	pages = (size + Memory::PAGE_SIZE - 1) / Memory::PAGE_SIZE;
+	image = (uint8_t *)Memory::alloc_pages(pages);
+	if (!image) return Remote::FAIL_NO_MEMORY;
+	return Remote::SUCCESS;
+    }
+
+    Remote::Error data(const Remote::Frame &frame) {
+	if (!image) return Remote::FAIL_NOT_NOW;
+	if (frame.length < 4) return Remote::FAIL_LENGTH;
+	uint32_t offset = Remote::get32(&frame.payload[0]);
+	uint32_t len = frame.length - 4;
+	// a repeat of the last block when our ACK got lost is fine, a
+	// gap is not
+	if (offset > received || len > size - offset) {
+	    return Remote::FAIL_INVALID_VALUE;
+	}
+	memcpy(&image[offset], &frame.payload[4], len);
+	if (offset + len > received) received = offset + len;
+	return Remote::SUCCESS;
+    }
+
+    Remote::Error check(void) {
+	if (!image) return Remote::FAIL_NOT_NOW;
+	if (received != size) return Remote::FAIL_LENGTH;
+	if (CRC::crc32(image, size) != crc) return Remote::FAIL_CRC;
+	if (SMP::core_id() != 0) return Remote::FAIL_NOT_NOW;
+	if (stub_addr + (chainload_stub_end - chainload_stub) > STUB_LIMIT) {
+	    return Remote::FAIL_NO_MEMORY;
+	}
+	return Remote::SUCCESS;
+    }
+
+    void boot(void) {
+	// the next kernel expects the boot clock, set_baud() may have
+	// raised it
+	UART::reset_clock();
+	// the handover code must be in memory for cores running it with
+	// the MMU and caches off
+	uint32_t stub_size = chainload_stub_end - chainload_stub;
+	memcpy((void *)stub_addr, chainload_stub, stub_size);
+	Cache::clean_range((void *)stub_addr, stub_size);
+	// ICIALLUIS, every core's instruction cache
+	asm volatile("mcr p15, 0, %0, c7, c1, 0" :: "r" (0));
+	data_sync_barrier();
+	instruction_barrier();
+
+	// The firmware cleared mailbox 3 when it released the cores, so
+	// mark it first. A core clears the mark once its caches are
+	// flushed and it no longer touches memory.
+	for (uint32_t core = 1; core < SMP::NUM_CORES; ++core) {
+	    *mailbox3_set(core) = PARK_MARK;
+	}
+	data_sync_barrier();
+	for (uint32_t core = 1; core < SMP::NUM_CORES; ++core) {
+	    IPI::post(core, IPI::PARK, 0);
+	}
+	for (uint32_t core = 1; core < SMP::NUM_CORES; ++core) {
+	    while (*mailbox3_clear(core) != 0) { }
+	}
+
+	asm volatile("cpsid if");
+	boot_fn start = (boot_fn)relocated(chainload_boot);
+	start(image, size, model, tags);
+	while(true) { }
+    }
+}
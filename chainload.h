@@ -0,0 +1,58 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * UART chainloader for the Raspberry Pi 2
+ *
+ * Receives a kernel image over the remote protocol and starts it in
+ * place of the running one, as if the firmware had loaded it from the
+ * SD card. Cores 1-3 are parked the way the firmware leaves them, so
+ * the new kernel's SMP::start_cores() finds them.
+ */
+
+#ifndef KERNEL_CHAINLOAD_H
+#define KERNEL_CHAINLOAD_H 1
+
+#include <stdint.h>
+#include "remote.h"
+
+namespace Chainload {
+    enum {
+	LOAD_ADDR = 0x8000,  // where the firmware loads kernel.img
+	STUB_ADDR = 0x1000,  // handover code, past the ATAGs
+	STUB_LIMIT = 0x4000, // the boot stack of core 0 grows down to here
+	MAX_IMAGE = 0x400000 - LOAD_ADDR,
+    };
+
+    // remember what the firmware passed to kernel_main, the new kernel
+    // gets the same
+    void init(uint32_t model_id, const void *atags);
+
+    // LOAD_BEGIN, drops an earlier image
+    Remote::Error begin(const Remote::Frame &frame);
+    // LOAD_DATA, in order, repeats are accepted
+    Remote::Error data(const Remote::Frame &frame);
+    // LOAD_BOOT: the image is complete and its CRC matches
+    Remote::Error check(void);
+
+    /* Start the image, needs check() to succeed first and must run on
+     * core 0. Whatever else runs is abandoned, flush it first.
+     */
+    void boot(void) __attribute__((noreturn));
+}
+
+#endif // #ifndef KERNEL_CHAINLOAD_H
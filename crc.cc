@@ -0,0 +1,60 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * CRC-32 (IEEE 802.3, as used by zlib) for the Raspberry Pi
+ *
+ * Byte at a time with a 1k table built on first use. Building it twice
+ * from different cores is harmless, both write the same values.
+ */
+
+#include <stdint.h>
+#include "crc.h"
+#include "barriers.h"
+
+namespace CRC {
+    enum {
+	POLYNOMIAL = 0xEDB88320, // reversed 0x04C11DB7
+    };
+
+    static uint32_t table[256];
+    static volatile bool have_table;
+
+    static void make_table(void) {
+	for (uint32_t i = 0; i < 256; ++i) {
+	    uint32_t c = i;
+	    for (int k = 0; k < 8; ++k) {
+		c = (c & 1) ? (c >> 1) ^ POLYNOMIAL : c >> 1;
+	    }
+	    table[i] = c;
+	}
+	// table before the flag
+	data_memory_barrier();
+	have_table = true;
+    }
+
+    uint32_t crc32(const void *data, size_t len, uint32_t crc) {
+	if (!have_table) make_table();
+	data_memory_barrier();
+	const uint8_t *p = (const uint8_t *)data;
+	crc = ~crc;
+	while (len-- > 0) {
+	    crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+    }
+}
@@ -0,0 +1,34 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * CRC-32 (IEEE 802.3, as used by zlib) for the Raspberry Pi
+ */
+
+#ifndef KERNEL_CRC_H
+#define KERNEL_CRC_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace CRC {
+    // crc of the data, pass the previous result to continue a crc over
+    // several pieces
+    uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+}
+
+#endif // #ifndef KERNEL_CRC_H
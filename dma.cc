@@ -0,0 +1,161 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * BCM2835 DMA controller for the Raspberry Pi 2
+ */
+
+#include <stdint.h>
+#include "dma.h"
+#include "peripherals.h"
+#include "irq.h"
+#include "cache.h"
+#include "barriers.h"
+#include "sched.h"
+#include "sync.h"
+
+namespace DMA {
+    enum {
+	BASE = 0x7000, // 0x3F007000
+	ENABLE = 0xFF0, // 0x3F007FF0, one bit per channel
+
+	// the firmware leaves channels 0, 2, 4, 5 and 8-14 to the ARM
+	CHANNEL = 5,
+	CHANNEL_BASE = BASE + CHANNEL * 0x100,
+
+	// channel registers
+	CS        = 0x00,
+	CONBLK_AD = 0x04,
+	DEBUG     = 0x20,
+
+	// Control and Status
+	CS_RESET    = 1u << 31,
+	CS_ABORT    = 1 << 30,
+	CS_WAIT_FOR_OUTSTANDING_WRITES = 1 << 28,
+	CS_PANIC_PRIORITY = 15 << 20,
+	CS_PRIORITY = 8 << 16,
+	CS_ERROR    = 1 << 8,
+	CS_INT      = 1 << 2,
+	CS_END      = 1 << 1,
+	CS_ACTIVE   = 1 << 0,
+
+	// Transfer Information
+	TI_NO_WIDE_BURSTS = 1 << 26,
+	TI_PERMAP_SHIFT   = 16,
+	TI_SRC_DREQ       = 1 << 10,
+	TI_SRC_INC        = 1 << 8,
+	TI_DEST_DREQ      = 1 << 6,
+	TI_DEST_INC       = 1 << 4,
+	TI_WAIT_RESP      = 1 << 3,
+	TI_INTEN          = 1 << 0,
+
+	// Debug: write 1 to clear
+	DEBUG_ERRORS = 7,
+
+	// ARM physical to VC bus address, L2 cache disabled alias, and
+	// the peripherals as the DMA sees them
+	BUS_ALIAS = 0xC0000000,
+	PERIPHERAL_BUS = 0x7E000000,
+    };
+
+    constexpr volatile uint32_t * reg(uint32_t offset) {
+	return Peripherals::reg(CHANNEL_BASE + offset);
+    }
+
+    struct ControlBlock {
+	uint32_t ti;
+	uint32_t source_ad;
+	uint32_t dest_ad;
+	uint32_t txfr_len;
+	uint32_t stride;
+	uint32_t nextconbk;
+	uint32_t reserved[2];
+    } __attribute__((aligned(32)));
+
+    static ControlBlock control_block;
+    static Sync::Atomic<uint32_t> done;
+    static Sched::WaitQueue done_wait;
+    // status of the last transfer
+    static volatile uint32_t status;
+
+    static uint32_t bus_address(const volatile void *p) {
+	return (uint32_t)p | BUS_ALIAS;
+    }
+
+    static uint32_t peripheral_bus_address(uint32_t reg_phys) {
+	return reg_phys - Peripherals::PERIPHERAL_BASE + PERIPHERAL_BUS;
+    }
+
+    static void handle_irq(uint32_t, void *) {
+	uint32_t cs = *reg(CS);
+	// write 1 to clear the interrupt and end flags
+	*reg(CS) = CS_INT | CS_END;
+	status = cs;
+	done.store(1, Sync::RELEASE);
+	done_wait.wake_all();
+    }
+
+    void init(void) {
+	volatile uint32_t *enable = Peripherals::reg(BASE + ENABLE);
+	*enable |= 1 << CHANNEL;
+	*reg(CS) = CS_RESET;
+	*reg(DEBUG) = DEBUG_ERRORS;
+	IRQ::set_handler(IRQ::DMA0 + CHANNEL, handle_irq, 0);
+	IRQ::enable(IRQ::DMA0 + CHANNEL);
+    }
+
+    static bool run(uint32_t ti, uint32_t source, uint32_t dest, uint32_t len) {
+	ControlBlock &cb = control_block;
+	cb.ti = ti | TI_INTEN | TI_NO_WIDE_BURSTS;
+	cb.source_ad = source;
+	cb.dest_ad = dest;
+	cb.txfr_len = len;
+	cb.stride = 0;
+	cb.nextconbk = 0;
+	Cache::clean_range(&cb, sizeof(cb));
+	done.store(0, Sync::RELAXED);
+	// control block and buffers before the DMA starts
+	data_sync_barrier();
+	*reg(CONBLK_AD) = bus_address(&cb);
+	*reg(CS) = CS_WAIT_FOR_OUTSTANDING_WRITES | CS_PANIC_PRIORITY
+	    | CS_PRIORITY | CS_ACTIVE;
+	done_wait.wait_until([]() { return done.load(Sync::ACQUIRE) != 0; });
+	if (status & CS_ERROR) {
+	    *reg(DEBUG) = DEBUG_ERRORS;
+	    return false;
+	}
+	return true;
+    }
+
+    bool from_device(void *buf, uint32_t reg_phys, uint32_t len, Dreq dreq) {
+	// no dirty line may be evicted over what the DMA writes
+	Cache::clean_invalidate_range(buf, len);
+	uint32_t ti = TI_DEST_INC | TI_WAIT_RESP | dreq << TI_PERMAP_SHIFT;
+	if (dreq != DREQ_NONE) ti |= TI_SRC_DREQ;
+	bool ok = run(ti, peripheral_bus_address(reg_phys), bus_address(buf), len);
+	// lines speculatively loaded meanwhile are stale
+	Cache::invalidate_range(buf, len);
+	return ok;
+    }
+
+    bool to_device(uint32_t reg_phys, const void *buf, uint32_t len, Dreq dreq) {
+	Cache::clean_range(buf, len);
+	uint32_t ti = TI_SRC_INC | TI_WAIT_RESP | dreq << TI_PERMAP_SHIFT;
+	if (dreq != DREQ_NONE) ti |= TI_DEST_DREQ;
+	return run(ti, bus_address(buf), peripheral_bus_address(reg_phys), len);
+    }
+}
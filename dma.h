@@ -0,0 +1,50 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * BCM2835 DMA controller for the Raspberry Pi 2
+ *
+ * One channel serves peripherals with a FIFO register, transfers are
+ * paced by the peripheral's DREQ line and the caller sleeps until the
+ * completion interrupt. Only one transfer runs at a time.
+ */
+
+#ifndef KERNEL_DMA_H
+#define KERNEL_DMA_H 1
+
+#include <stdint.h>
+
+namespace DMA {
+    // peripherals pacing a transfer
+    enum Dreq {
+	DREQ_NONE = 0,
+	DREQ_EMMC = 11,
+    };
+
+    // core 0: reset the channel and install the interrupt handler
+    void init(void);
+
+    /* Move len bytes between memory and a peripheral register given as
+     * its ARM physical address. buf should be cache line aligned and
+     * padded, its lines are cleaned / invalidated here. Returns false
+     * on a DMA error.
+     */
+    bool from_device(void *buf, uint32_t reg, uint32_t len, Dreq dreq);
+    bool to_device(uint32_t reg, const void *buf, uint32_t len, Dreq dreq);
+}
+
+#endif // #ifndef KERNEL_DMA_H
@@ -0,0 +1,374 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * SD card on the EMMC (Arasan SDHCI) host controller of the
+ * Raspberry Pi 2
+ *
+ * Follows the SD simplified physical layer and host controller specs:
+ * identify at 400kHz, switch to 4 bit and 25MHz in transfer state.
+ */
+
+#include <stdint.h>
+#include "emmc.h"
+#include "peripherals.h"
+#include "mailbox.h"
+#include "dma.h"
+#include "time.h"
+#include "sched.h"
+
+namespace EMMC {
+    enum {
+	BASE = 0x300000, // 0x3F300000
+
+	ARG2       = 0x00,
+	BLKSIZECNT = 0x04,
+	ARG1       = 0x08,
+	CMDTM      = 0x0C,
+	RESP0      = 0x10,
+	RESP1      = 0x14,
+	RESP2      = 0x18,
+	RESP3      = 0x1C,
+	DATA       = 0x20,
+	STATUS     = 0x24,
+	CONTROL0   = 0x28,
+	CONTROL1   = 0x2C,
+	INTERRUPT  = 0x30,
+	IRPT_MASK  = 0x34,
+	IRPT_EN    = 0x38,
+	CONTROL2   = 0x3C,
+	SLOTISR_VER = 0xFC,
+
+	// Command and transfer mode
+	TM_BLKCNT_EN   = 1 << 1,
+	TM_AUTO_CMD12  = 1 << 2,
+	TM_DAT_DIR_READ = 1 << 4,
+	TM_MULTI_BLOCK = 1 << 5,
+	CMD_RSPNS_NONE = 0 << 16,
+	CMD_RSPNS_136  = 1 << 16,
+	CMD_RSPNS_48   = 2 << 16,
+	CMD_RSPNS_48B  = 3 << 16,
+	CMD_CRCCHK_EN  = 1 << 19,
+	CMD_IXCHK_EN   = 1 << 20,
+	CMD_ISDATA     = 1 << 21,
+	CMD_INDEX_SHIFT = 24,
+
+	// response types
+	RESP_NONE = CMD_RSPNS_NONE,
+	RESP_R1   = CMD_RSPNS_48 | CMD_CRCCHK_EN | CMD_IXCHK_EN,
+	RESP_R1B  = CMD_RSPNS_48B | CMD_CRCCHK_EN | CMD_IXCHK_EN,
+	RESP_R2   = CMD_RSPNS_136 | CMD_CRCCHK_EN,
+	RESP_R3   = CMD_RSPNS_48,
+	RESP_R6   = RESP_R1,
+	RESP_R7   = RESP_R1,
+
+	// Status
+	STATUS_CMD_INHIBIT = 1 << 0,
+	STATUS_DAT_INHIBIT = 1 << 1,
+
+	// Control 0
+	CONTROL0_HCTL_DWIDTH = 1 << 1, // 4 bit data
+
+	// Control 1
+	CONTROL1_CLK_INTLEN = 1 << 0,
+	CONTROL1_CLK_STABLE = 1 << 1,
+	CONTROL1_CLK_EN     = 1 << 2,
+	CONTROL1_CLK_FREQ_MS2_SHIFT = 6,
+	CONTROL1_CLK_FREQ8_SHIFT = 8,
+	CONTROL1_CLK_FREQ_MASK = 0xFFC0,
+	CONTROL1_DATA_TOUNIT_MAX = 0xE << 16,
+	CONTROL1_SRST_HC    = 1 << 24,
+	CONTROL1_SRST_CMD   = 1 << 25,
+	CONTROL1_SRST_DATA  = 1 << 26,
+
+	// Interrupt flags
+	INT_CMD_DONE  = 1 << 0,
+	INT_DATA_DONE = 1 << 1,
+	INT_ERR       = 1 << 15,
+	INT_CTO_ERR   = 1 << 16, // command timeout
+	INT_ERRORS    = 0xFFFF0000,
+	INT_ALL       = 0xFFFFFFFF,
+
+	// commands
+	GO_IDLE_STATE        = 0,
+	ALL_SEND_CID         = 2,
+	SEND_RELATIVE_ADDR   = 3,
+	SELECT_CARD          = 7,
+	SEND_IF_COND         = 8,
+	SEND_CSD             = 9,
+	SET_BLOCKLEN         = 16,
+	READ_SINGLE_BLOCK    = 17,
+	READ_MULTIPLE_BLOCK  = 18,
+	WRITE_BLOCK          = 24,
+	WRITE_MULTIPLE_BLOCK = 25,
+	APP_CMD              = 55,
+	// after APP_CMD
+	SET_BUS_WIDTH        = 6,
+	SD_SEND_OP_COND      = 41,
+
+	IF_COND_CHECK = 0x1AA, // 2.7-3.6V, check pattern 0xAA
+	OCR_VOLTAGES  = 0x00FF8000,
+	OCR_HCS       = 1 << 30, // high capacity
+	OCR_READY     = 1u << 31,
+
+	IDENT_CLOCK = 400000,
+	TRANSFER_CLOCK = 25000000,
+	CLOCK_ID_EMMC = 1,
+	// if the firmware won't tell
+	DEFAULT_BASE_CLOCK = 100000000,
+
+	COMMAND_US = 100000,
+	DATA_US = 1000000,
+	INIT_US = 1000000,
+    };
+
+    constexpr volatile uint32_t * reg(uint32_t offset) {
+	return Peripherals::reg(BASE + offset);
+    }
+
+    static uint32_t base_clock;
+    static uint32_t rca; // relative card address << 16
+    static bool high_capacity; // addressed by block, not by byte
+    static uint32_t num_blocks;
+
+    // wait for any of the flags, errors end the wait too
+    static Error wait_interrupt(uint32_t flags, uint32_t us) {
+	Time::Timeout timeout = Time::timeout_us(us);
+	uint32_t irq;
+	while (!((irq = *reg(INTERRUPT)) & (flags | INT_ERR))) {
+	    if (timeout.expired()) return FAIL_TIMEOUT;
+	}
+	if (irq & INT_ERR) {
+	    *reg(INTERRUPT) = irq & (INT_ERRORS | INT_ERR);
+	    return (irq & INT_CTO_ERR) ? FAIL_TIMEOUT : FAIL_COMMAND;
+	}
+	*reg(INTERRUPT) = irq & flags;
+	return SUCCESS;
+    }
+
+    static Error wait_status_clear(uint32_t bits, uint32_t us) {
+	Time::Timeout timeout = Time::timeout_us(us);
+	while (*reg(STATUS) & bits) {
+	    if (timeout.expired()) return FAIL_TIMEOUT;
+	    // a write may keep the card busy for a while
+	    Sched::yield();
+	}
+	return SUCCESS;
+    }
+
+    static Error command(uint32_t index, uint32_t arg, uint32_t flags) {
+	uint32_t inhibit = STATUS_CMD_INHIBIT;
+	if (flags & (CMD_ISDATA | CMD_RSPNS_48B)) inhibit |= STATUS_DAT_INHIBIT;
+	Error err = wait_status_clear(inhibit, COMMAND_US);
+	if (err != SUCCESS) return err;
+	*reg(INTERRUPT) = INT_ALL;
+	*reg(ARG1) = arg;
+	*reg(CMDTM) = index << CMD_INDEX_SHIFT | flags;
+	err = wait_interrupt(INT_CMD_DONE, COMMAND_US);
+	if (err != SUCCESS) {
+	    // the command line stays inhibited after errors
+	    *reg(CONTROL1) |= CONTROL1_SRST_CMD;
+	    Time::Timeout timeout = Time::timeout_us(COMMAND_US);
+	    while ((*reg(CONTROL1) & CONTROL1_SRST_CMD) && !timeout.expired()) { }
+	}
+	return err;
+    }
+
+    static Error app_command(uint32_t index, uint32_t arg, uint32_t flags) {
+	Error err = command(APP_CMD, rca, RESP_R1);
+	if (err != SUCCESS) return err;
+	return command(index, arg, flags);
+    }
+
+    // base clock of the controller from the firmware
+    static uint32_t get_base_clock(void) {
+	uint32_t mailbuffer[16] __attribute__((aligned(64)));
+	mailbuffer[0] = 8 * 4; // Total size
+	mailbuffer[1] = 0; // Request
+	mailbuffer[2] = 0x00030002; // Tag id (get clock rate)
+	mailbuffer[3] = 8; // Value buffer size (bytes)
+	mailbuffer[4] = 4; // Req. + value length (bytes)
+	mailbuffer[5] = CLOCK_ID_EMMC; // Clock id
+	mailbuffer[6] = 0; // Space for the rate
+	mailbuffer[7] = 0; // End tag
+
+	uint32_t *buf = Mailbox::call(Mailbox::PROPERTY, mailbuffer);
+
+	if (buf[1] != 0x80000000 || buf[5] != CLOCK_ID_EMMC || buf[6] == 0) {
+	    return DEFAULT_BASE_CLOCK;
+	}
+	return buf[6];
+    }
+
+    // SDHCI 3.0 10 bit divided clock: base / (2 * divider)
+    static Error set_clock(uint32_t freq) {
+	uint32_t divider = (base_clock + 2 * freq - 1) / (2 * freq);
+	if (divider > 0x3FF) divider = 0x3FF;
+	if (wait_status_clear(STATUS_CMD_INHIBIT | STATUS_DAT_INHIBIT,
+			      COMMAND_US) != SUCCESS) {
+	    return FAIL_CLOCK;
+	}
+	uint32_t control1 = *reg(CONTROL1) & ~CONTROL1_CLK_EN;
+	*reg(CONTROL1) = control1;
+	control1 &= ~CONTROL1_CLK_FREQ_MASK;
+	control1 |= (divider & 0xFF) << CONTROL1_CLK_FREQ8_SHIFT;
+	control1 |= (divider >> 8) << CONTROL1_CLK_FREQ_MS2_SHIFT;
+	control1 |= CONTROL1_CLK_INTLEN;
+	*reg(CONTROL1) = control1;
+	Time::Timeout timeout = Time::timeout_us(COMMAND_US);
+	while (!(*reg(CONTROL1) & CONTROL1_CLK_STABLE)) {
+	    if (timeout.expired()) return FAIL_CLOCK;
+	}
+	*reg(CONTROL1) = control1 | CONTROL1_CLK_EN;
+	// the card wants a few clocks before the next command
+	Time::delay_us(100);
+	return SUCCESS;
+    }
+
+    // capacity from the CSD, the response registers hold CSD[127:8]
+    static uint32_t csd_blocks(void) {
+	uint32_t r1 = *reg(RESP1);
+	uint32_t r2 = *reg(RESP2);
+	uint32_t r3 = *reg(RESP3);
+	uint32_t structure = (r3 >> 22) & 3; // CSD[127:126]
+	if (structure == 1) {
+	    // C_SIZE = CSD[69:48], (C_SIZE + 1) * 512kB
+	    uint32_t c_size = (r1 >> 8) & 0x3FFFFF;
+	    return (c_size + 1) * 1024;
+	}
+	// C_SIZE = CSD[73:62], C_SIZE_MULT = CSD[49:47],
+	// READ_BL_LEN = CSD[83:80]
+	uint32_t c_size = (r2 & 3) << 10 | r1 >> 22;
+	uint32_t mult = (r1 >> 7) & 7;
+	uint32_t read_bl_len = (r2 >> 8) & 0xF;
+	return ((c_size + 1) << (mult + 2)) << read_bl_len >> 9;
+    }
+
+    Error init(void) {
+	num_blocks = 0;
+	base_clock = get_base_clock();
+
+	*reg(CONTROL0) = 0;
+	*reg(CONTROL1) = CONTROL1_SRST_HC;
+	Time::Timeout timeout = Time::timeout_us(INIT_US);
+	while (*reg(CONTROL1) & (CONTROL1_SRST_HC | CONTROL1_SRST_CMD
+				 | CONTROL1_SRST_DATA)) {
+	    if (timeout.expired()) return FAIL_RESET;
+	}
+	*reg(CONTROL1) = CONTROL1_DATA_TOUNIT_MAX | CONTROL1_CLK_INTLEN;
+	if (set_clock(IDENT_CLOCK) != SUCCESS) return FAIL_CLOCK;
+
+	// flags show in INTERRUPT, nothing goes to the ARM
+	*reg(IRPT_EN) = 0;
+	*reg(IRPT_MASK) = INT_ALL;
+	*reg(INTERRUPT) = INT_ALL;
+
+	Error err = command(GO_IDLE_STATE, 0, RESP_NONE);
+	if (err != SUCCESS) return FAIL_NO_CARD;
+
+	// version 2 cards echo the check pattern, version 1 time out
+	bool v2 = command(SEND_IF_COND, IF_COND_CHECK, RESP_R7) == SUCCESS;
+	if (v2 && (*reg(RESP0) & 0xFFF) != IF_COND_CHECK) return FAIL_VOLTAGE;
+
+	rca = 0;
+	uint32_t ocr;
+	timeout = Time::timeout_us(INIT_US);
+	do {
+	    if (timeout.expired()) return FAIL_VOLTAGE;
+	    err = app_command(SD_SEND_OP_COND,
+			      OCR_VOLTAGES | (v2 ? (uint32_t)OCR_HCS : 0), RESP_R3);
+	    if (err != SUCCESS) return FAIL_NO_CARD;
+	    ocr = *reg(RESP0);
+	} while (!(ocr & OCR_READY));
+	high_capacity = ocr & OCR_HCS;
+
+	if ((err = command(ALL_SEND_CID, 0, RESP_R2)) != SUCCESS) return err;
+	if ((err = command(SEND_RELATIVE_ADDR, 0, RESP_R6)) != SUCCESS) return err;
+	rca = *reg(RESP0) & 0xFFFF0000;
+	if ((err = command(SEND_CSD, rca, RESP_R2)) != SUCCESS) return err;
+	uint32_t capacity = csd_blocks();
+	if ((err = command(SELECT_CARD, rca, RESP_R1B)) != SUCCESS) return err;
+	if (!high_capacity) {
+	    err = command(SET_BLOCKLEN, BLOCK_SIZE, RESP_R1);
+	    if (err != SUCCESS) return err;
+	}
+	// 4 bit bus
+	if ((err = app_command(SET_BUS_WIDTH, 2, RESP_R1)) != SUCCESS) return err;
+	*reg(CONTROL0) |= CONTROL0_HCTL_DWIDTH;
+	if (set_clock(TRANSFER_CLOCK) != SUCCESS) return FAIL_CLOCK;
+
+	num_blocks = capacity;
+	return SUCCESS;
+    }
+
+    uint32_t blocks(void) {
+	return num_blocks;
+    }
+
+    // the data line stays busy after errors
+    static void reset_data(void) {
+	*reg(CONTROL1) |= CONTROL1_SRST_DATA;
+	Time::Timeout timeout = Time::timeout_us(COMMAND_US);
+	while ((*reg(CONTROL1) & CONTROL1_SRST_DATA) && !timeout.expired()) { }
+    }
+
+    static Error transfer(uint32_t lba, uint32_t count, void *buf, bool reading) {
+	if (count == 0) return SUCCESS;
+	if (num_blocks == 0) return FAIL_NO_CARD;
+	if (count > MAX_BLOCKS || lba >= num_blocks || count > num_blocks - lba) {
+	    return FAIL_RANGE;
+	}
+	uint32_t flags = RESP_R1 | CMD_ISDATA;
+	uint32_t index;
+	if (count > 1) {
+	    flags |= TM_MULTI_BLOCK | TM_BLKCNT_EN | TM_AUTO_CMD12;
+	    index = reading ? READ_MULTIPLE_BLOCK : WRITE_MULTIPLE_BLOCK;
+	} else {
+	    index = reading ? READ_SINGLE_BLOCK : WRITE_BLOCK;
+	}
+	if (reading) flags |= TM_DAT_DIR_READ;
+	uint32_t address = high_capacity ? lba : lba * BLOCK_SIZE;
+
+	*reg(BLKSIZECNT) = count << 16 | BLOCK_SIZE;
+	Error err = command(index, address, flags);
+	if (err != SUCCESS) {
+	    reset_data();
+	    return err;
+	}
+	uint32_t data = Peripherals::PERIPHERAL_BASE + BASE + DATA;
+	bool ok = reading
+	    ? DMA::from_device(buf, data, count * BLOCK_SIZE, DMA::DREQ_EMMC)
+	    : DMA::to_device(data, buf, count * BLOCK_SIZE, DMA::DREQ_EMMC);
+	if (!ok) {
+	    reset_data();
+	    return FAIL_DMA;
+	}
+	if ((err = wait_interrupt(INT_DATA_DONE, DATA_US)) != SUCCESS) {
+	    reset_data();
+	    return FAIL_DATA;
+	}
+	return SUCCESS;
+    }
+
+    Error read(uint32_t lba, uint32_t count, void *buf) {
+	return transfer(lba, count, buf, true);
+    }
+
+    Error write(uint32_t lba, uint32_t count, const void *buf) {
+	return transfer(lba, count, const_cast<void *>(buf), false);
+    }
+}
@@ -0,0 +1,66 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * SD card on the EMMC (Arasan SDHCI) host controller of the
+ * Raspberry Pi 2
+ *
+ * Data moves by DMA paced by the controller's DREQ, the CPU only
+ * issues commands. One caller at a time.
+ */
+
+#ifndef KERNEL_EMMC_H
+#define KERNEL_EMMC_H 1
+
+#include <stdint.h>
+
+namespace EMMC {
+    enum {
+	BLOCK_SIZE = 512,
+	// BLKSIZECNT has 16 bits for the count
+	MAX_BLOCKS = 65535,
+    };
+
+    enum Error {
+	SUCCESS = 0,
+	FAIL_RESET,
+	FAIL_CLOCK,
+	FAIL_TIMEOUT,
+	FAIL_COMMAND,
+	FAIL_VOLTAGE,
+	FAIL_DATA,
+	FAIL_DMA,
+	FAIL_NO_CARD,
+	FAIL_RANGE,
+	FAIL_NO_MEMORY, // for the block cache
+    };
+
+    // reset the controller and bring the card into transfer state,
+    // needs DMA::init() and the scheduler
+    Error init(void);
+
+    // card capacity in blocks, 0 without a card
+    uint32_t blocks(void);
+
+    /* Multi-block transfers, buf should be cache line aligned and
+     * padded (see DMA).
+     */
+    Error read(uint32_t lba, uint32_t count, void *buf);
+    Error write(uint32_t lba, uint32_t count, const void *buf);
+}
+
+#endif // #ifndef KERNEL_EMMC_H
@@ -126,10 +126,12 @@ namespace Font {
 {  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0}, // <pad>
     };
     
-void putc(const Framebuffer::FB &fb, uint32_t x, uint32_t y, char c,
-	  uint32_t color, uint32_t border, bool fill) {
-	uint32_t *base = (uint32_t*)fb.base;
-	uint32_t pitch = fb.pitch / 4;
+    template<typename Format>
+    void putc(const Framebuffer::Surface<Format> &surface,
+	      uint32_t x, uint32_t y, char c,
+	      typename Format::Pixel color, typename Format::Pixel border,
+	      bool fill) {
+	typedef typename Format::Pixel Pixel;
 	if ((c < 32) || (c > 127)) {
 	    // non printable chars get checkers
 	    c = 127;
@@ -138,15 +140,13 @@ void putc(const Framebuffer::FB &fb, uint32_t x, uint32_t y, char c,
 	c -= 31;
 	// lookup glyph
 	uint8_t *glyph = data[(int)c];
-	// row pointer for framebuffer
-	uint32_t *row = &base[y * pitch];
 	for (uint32_t v = 0; v < 16; ++v) {
-	    if (y + v >= fb.height) break;
+	    if (y + v >= surface.height) break;
 	    uint16_t mask = 0x80;
 	    // pixel position in the row
-	    uint32_t *pixel = &row[x];
+	    Pixel *pixel = &surface.row(y + v)[x];
 	    for (uint32_t u = 0; u < 8; ++u) {
-		if (x + u >= fb.width) break;
+		if (x + u >= surface.width) break;
 		// Draw color if bit is set
 		// Draw border if bit right, left, below or above is set
 		// Otherwise draw border if fill or skip pixel
@@ -168,7 +168,17 @@ void putc(const Framebuffer::FB &fb, uint32_t x, uint32_t y, char c,
 		mask >>= 1;
 	    }
 	    ++glyph;
-	    row += pitch;
 	}
     }
+
+    template void putc<Framebuffer::RGBA8888>(
+	const Framebuffer::Surface<Framebuffer::RGBA8888> &surface,
+	uint32_t x, uint32_t y, char c,
+	Framebuffer::RGBA8888::Pixel color,
+	Framebuffer::RGBA8888::Pixel border, bool fill);
+    template void putc<Framebuffer::RGB565>(
+	const Framebuffer::Surface<Framebuffer::RGB565> &surface,
+	uint32_t x, uint32_t y, char c,
+	Framebuffer::RGB565::Pixel color,
+	Framebuffer::RGB565::Pixel border, bool fill);
 }
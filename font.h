@@ -23,8 +23,12 @@
 #include "framebuffer.h"
 
 namespace Font {
-    void putc(const Framebuffer::FB &fb, uint32_t x, uint32_t y, char c,
-	      uint32_t color = ~0L, uint32_t border = 0, bool fill = false);
+    // instantiated for Framebuffer::RGBA8888 and Framebuffer::RGB565
+    template<typename Format>
+    void putc(const Framebuffer::Surface<Format> &surface,
+	      uint32_t x, uint32_t y, char c,
+	      typename Format::Pixel color, typename Format::Pixel border,
+	      bool fill = false);
 }
 
 #endif // #ifndef FONT_H
@@ -21,73 +21,83 @@
 
 #include <stdint.h>
 #include "framebuffer.h"
-#include "peripherals.h"
-#include "barriers.h"
+#include "mailbox.h"
+#include "mmu.h"
 #include "stdio.h"
 #include "font.h"
 
 namespace Framebuffer {
-    enum {
-	// Mailbox registers
-	MAILBOX0READ   = 0xb880,
-	MAILBOX0STATUS = 0xb898,
-	MAILBOX0WRITE  = 0xb8a0,
-
-	// Channel for framebuffer
-	FBCHAN = 8,
-    };
+    FB fb;
 
-#define MAILBOX(x) (Peripherals::reg(x))
+    template<typename Format>
+    void test_pattern(void) {
+	typedef typename Format::Pixel Pixel;
+	Surface<Format> surface(fb);
 
-    FB fb;
+	// draw chessboard pattern
+	for(uint32_t y = 0; y < surface.height; ++y) {
+	    Pixel *p = surface.row(y);
+	    for(uint32_t x = 0; x < surface.width; ++x) {
+		uint8_t col = ((x & 16) ^ (y & 16)) ? 0x00 : 0xff;
+		p[x] = Format::rgb(col, col, col);
+	    }
+	}
 
-    // Status register
-    enum { SHIFT_EMPTY = 30, SHIFT_FULL };
-    enum Flags {
-	EMPTY = 1 << SHIFT_EMPTY,
-	FULL = 1 << SHIFT_FULL
-    };
-
-    void write(void *buf, uint32_t chan) {
-	volatile uint32_t *status = MAILBOX(MAILBOX0STATUS);
-	volatile uint32_t *write = MAILBOX(MAILBOX0WRITE);
-	data_memory_barrier();
-	// don't use cached values
-	flush_cache();
-	puts("status at ");
-	put_uint32((intptr_t)status);
-	putc('\n');
-	// wait for mailbox to be not full
-	while(*status & FULL) {
-	    puts("full\n");
-	    flush_cache();
+	// draw back->red fade left to right at the top
+	// draw back->blue fade left to right at the bottom
+	for(uint32_t y = 0; y < 16; ++y) {
+	    for(uint32_t x = 16; x < 256 + 16; ++x) {
+		surface.at(x, y) = Format::rgb(x - 16, 0, 0);
+		surface.at(x, surface.height - y - 1) = Format::rgb(0, 0, x - 16);
+	    }
+	}
+	// draw back->green fade top to bottom at the left
+	// draw back->green fade top to bottom at the right
+	for(uint32_t y = 16; y < 256 + 16; ++y) {
+	    for(uint32_t x = 0; x < 16; ++x) {
+		surface.at(x, y) = Format::rgb(0, y - 16, 0);
+		surface.at(surface.width - x - 1, y) =
+		    Format::rgb(y - 16, y - 16, y - 16);
+	    }
 	}
-	*write = (intptr_t)buf | chan;
-    }
 
-    void * read(uint32_t chan) {
-	volatile uint32_t *status = MAILBOX(MAILBOX0STATUS);
-	volatile uint32_t *read = MAILBOX(MAILBOX0READ);
-	// possibly switching peripheral
-	data_memory_barrier();
-	while(true) {
-	    // don't use cached values
-	    flush_cache();
-	    // wait for mailbox to contain something
-	    while(*status & EMPTY) {
-		flush_cache();
+	const char text[] = "MOOSE V0.0";
+	const Pixel white = Format::rgb(0xff, 0xff, 0xff);
+	const Pixel black = Format::rgb(0, 0, 0);
+	const Pixel colors[] = {
+	    white,
+	    Format::rgb(0xff, 0, 0),
+	    Format::rgb(0, 0xff, 0),
+	    Format::rgb(0, 0, 0xff),
+	};
+	uint32_t y = 152;
+	for (uint32_t i = 0; i < 16; ++i) {
+	    // white on black, black on white, then red, green and blue
+	    // with black and white border, each without and with fill
+	    Pixel color = colors[i / 4];
+	    Pixel border = (i % 2) ? white : black;
+	    if (i == 1 || i == 3) color = black;
+	    bool fill = (i % 4) >= 2;
+	    uint32_t x = 152;
+	    for (const char *p = text; *p; ++p) {
+		Font::putc<Format>(surface, x, y, *p, color, border, fill);
+		x += 8;
 	    }
-	    uint32_t res = *read;
-	    if ((res & 0xF) == chan) return (void *)(res & ~0xF);
+	    y += 16;
 	}
     }
-  
+
     // initialize framebuffer
-    Error init(void) {
+    Error init(uint32_t scale, uint32_t depth) {
 	puts("Framebuffer::init()\n");
 
+	if (scale == 0) return FAIL_INVALID_SCALE;
+	if (depth != RGBA8888::DEPTH && depth != RGB565::DEPTH) {
+	    return FAIL_INVALID_DEPTH;
+	}
+
 	// some spare memory for mail content
-	uint32_t mailbuffer[1024] __attribute__((aligned(16)));
+	uint32_t mailbuffer[1024] __attribute__((aligned(64)));
 	
 	/* Get the display size */
 	mailbuffer[0] = 8 * 4; // Total size
@@ -99,16 +109,25 @@ namespace Framebuffer {
 	mailbuffer[6] = 0; // Space for vertical resolution
 	mailbuffer[7] = 0; // End tag
 
-	write(mailbuffer, FBCHAN);
-	uint32_t *buf = (uint32_t *)read(FBCHAN);
+	uint32_t *buf = Mailbox::call(Mailbox::PROPERTY, mailbuffer);
 	
 	/* Valid response in data structure? */
 	if (buf[1] != 0x80000000) return FAIL_GET_RESOLUTION;
 
-	fb.width = buf[5];
-	fb.height = buf[6];
+	fb.display_width = buf[5];
+	fb.display_height = buf[6];
+
+	if (fb.display_width == 0 || fb.display_height == 0) {
+	    return FAIL_GOT_INVALID_RESOLUTION;
+	}
 
-	if (fb.width == 0 || fb.height == 0) return FAIL_GOT_INVALID_RESOLUTION;
+	// The virtual size always covers the whole display so changing the
+	// scale later only changes the physical size and never reallocates.
+	// It holds MAX_PAGES of those for flipping.
+	fb.scale = scale;
+	fb.width = fb.display_width / scale;
+	fb.height = fb.display_height / scale;
+	if (fb.width == 0 || fb.height == 0) return FAIL_INVALID_SCALE;
 
 	/* Set up screen */
 	unsigned int c = 1;
@@ -120,16 +139,18 @@ namespace Framebuffer {
 	mailbuffer[c++] = fb.width; // Horizontal resolution
 	mailbuffer[c++] = fb.height; // Vertical resolution
 
+	unsigned int virtual_tag = c;
 	mailbuffer[c++] = 0x00048004; // Tag id (set virtual size)
 	mailbuffer[c++] = 8; // Value buffer size (bytes)
 	mailbuffer[c++] = 8; // Req. + value length (bytes)
-	mailbuffer[c++] = fb.width; // Horizontal resolution
-	mailbuffer[c++] = fb.height; // Vertical resolution
+	mailbuffer[c++] = fb.display_width; // Horizontal resolution
+	mailbuffer[c++] = fb.display_height * MAX_PAGES; // Vertical resolution
 
+	unsigned int depth_tag = c;
 	mailbuffer[c++] = 0x00048005; // Tag id (set depth)
 	mailbuffer[c++] = 4; // Value buffer size (bytes)
 	mailbuffer[c++] = 4; // Req. + value length (bytes)
-	mailbuffer[c++] = 32; // 32 bpp
+	mailbuffer[c++] = depth; // bits per pixel
 
 	mailbuffer[c++] = 0x00040001; // Tag id (allocate framebuffer)
 	mailbuffer[c++] = 8; // Value buffer size (bytes)
@@ -141,12 +162,23 @@ namespace Framebuffer {
 
 	mailbuffer[0] = c*4; // Buffer size
 
-	write(mailbuffer, FBCHAN);
-	buf = (uint32_t *)read(FBCHAN);
+	buf = Mailbox::call(Mailbox::PROPERTY, mailbuffer);
 
 	/* Valid response in data structure */
 	if(buf[1] != 0x80000000) return FAIL_SETUP_FRAMEBUFFER;
 
+	/* Firmware may refuse the depth, only accept what we can draw */
+	if (buf[depth_tag + 2] != 0x80000004) return FAIL_INVALID_DEPTH;
+	fb.depth = buf[depth_tag + 3];
+	if (fb.depth != depth) return FAIL_INVALID_DEPTH;
+
+	/* Firmware may shrink the virtual height, use the pages we got */
+	fb.pages = buf[virtual_tag + 4] / fb.display_height;
+	if (fb.pages == 0) fb.pages = 1;
+	if (fb.pages > MAX_PAGES) fb.pages = MAX_PAGES;
+	fb.draw = 0;
+	fb.shown = 0;
+
 	// Scan replies for allocate response
 	unsigned int i = 2; /* First tag */
 	uint32_t data;
@@ -172,7 +204,8 @@ namespace Framebuffer {
 
 	if (fb.base == 0 || fb.size == 0) return FAIL_INVALID_TAG_DATA;
 
-	// fb.base += 0xC0000000; // physical to virtual
+	// bus to physical address
+	fb.base &= 0x3FFFFFFF;
 	
 	/* Get the framebuffer pitch (bytes per line) */
 	mailbuffer[0] = 7 * 4; // Total size
@@ -183,8 +216,7 @@ namespace Framebuffer {
 	mailbuffer[5] = 0; // Space for pitch
 	mailbuffer[6] = 0; // End tag
 
-	write(mailbuffer, FBCHAN);
-	buf = (uint32_t *)read(FBCHAN);
+	buf = Mailbox::call(Mailbox::PROPERTY, mailbuffer);
 
 	/* 4 bytes, plus MSB set to indicate a response */
 	if (buf[4] != 0x80000004) return FAIL_INVALID_PITCH_RESPONSE;
@@ -192,87 +224,89 @@ namespace Framebuffer {
 	fb.pitch = buf[5];
 	if (fb.pitch == 0) return FAIL_INVALID_PITCH_DATA;
 
-	// set alpha to 0xff everywhere
-	for(uint32_t n = 3; n < fb.size; n += 4) {
-	    *(uint8_t*)(fb.base + n) = 0xff;
+	if (fb.depth == RGB565::DEPTH) {
+	    test_pattern<RGB565>();
+	} else {
+	    test_pattern<RGBA8888>();
 	}
 
-	// draw chessboard pattern
-	for(uint32_t y = 0; y < fb.height; ++y) {
-	    for(uint32_t x = 0; x < fb.width; ++x) {
-		Pixel *p = (Pixel*)(fb.base + x * sizeof(Pixel) + y * fb.pitch);
-		uint8_t col = ((x & 16) ^ (y & 16)) ? 0x00 : 0xff;
-		p->red = col;
-		p->green = col;
-		p->blue = col;
-	    }
-	}
+	return SUCCESS;
+    }
 
-	// draw back->red fade left to right at the top
-	// draw back->blue fade left to right at the bottom
-	for(int y = 0; y < 16; ++y) {
-	    for(int x = 16; x < 256 + 16; ++x) {
-		Pixel *p = (Pixel*)(fb.base + x * sizeof(Pixel) + y * fb.pitch);
-		p->red = x - 16;
-		p->green = 0;
-		p->blue = 0;
-		p = (Pixel*)(fb.base + x * sizeof(Pixel) + (fb.height - y - 1) * fb.pitch);
-		p->red = 0;
-		p->green = 0;
-		p->blue = x - 16;
-	    }
-	}
-	// draw back->green fade top to bottom at the left
-	// draw back->green fade top to bottom at the right
-	for(int y = 16; y < 256 + 16; ++y) {
-	    for(int x = 0; x < 16; ++x) {
-		Pixel *p = (Pixel*)(fb.base + x * sizeof(Pixel) + y * fb.pitch);
-		p->red = 0;
-		p->green = y - 16;
-		p->blue = 0;
-		p = (Pixel*)(fb.base + (fb.width - x- 1) * sizeof(Pixel) + y * fb.pitch);
-		p->red = y - 16;
-		p->green = y - 16;
-		p->blue = y - 16;		
-	    }
-	}
+    Error set_scale(uint32_t scale) {
+	if (scale == 0) return FAIL_INVALID_SCALE;
+	uint32_t width = fb.display_width / scale;
+	uint32_t height = fb.display_height / scale;
+	if (width == 0 || height == 0) return FAIL_INVALID_SCALE;
+	if (scale == fb.scale) return SUCCESS;
 
-	const char text[] = "MOOSE V0.0";
-	struct Arg {
-	    uint32_t color;
-	    uint32_t border;
-	    bool fill;
-	} args[] = {
-	    {~0LU,  0, false},
-	    { 0, ~0LU, false},
-	    {~0LU,  0, true},
-	    { 0, ~0LU, true},
-	    {0xff0000ff,  0,   false},
-	    {0xff0000ff, ~0LU, false},
-	    {0xff0000ff,  0,   true},
-	    {0xff0000ff, ~0LU, true},
-	    {0xff00ff00,  0,   false},
-	    {0xff00ff00, ~0LU, false},
-	    {0xff00ff00,  0,   true},
-	    {0xff00ff00, ~0LU, true},
-	    {0xffff0000,  0,   false},
-	    {0xffff0000, ~0LU, false},
-	    {0xffff0000,  0,   true},
-	    {0xffff0000, ~0LU, true},
-	};
-	int y = 152;
-	Arg *arg = args;
-	for (i = 0; i < 16; ++i) {
-	    int x = 152;
-	    for (const char *p = text; *p; ++p) {
-		Font::putc(fb, x, y, *p, arg->color, arg->border, arg->fill);
-		x += 8;
-	    }
-	    y += 16;
-	    ++arg;
-	}
-	
+	uint32_t mailbuffer[16] __attribute__((aligned(64)));
+	unsigned int c = 1;
+	mailbuffer[c++] = 0; // Request
+
+	mailbuffer[c++] = 0x00048003; // Tag id (set physical size)
+	mailbuffer[c++] = 8; // Value buffer size (bytes)
+	mailbuffer[c++] = 8; // Req. + value length (bytes)
+	mailbuffer[c++] = width; // Horizontal resolution
+	mailbuffer[c++] = height; // Vertical resolution
+
+	mailbuffer[c++] = 0x00048009; // Tag id (set virtual offset)
+	mailbuffer[c++] = 8; // Value buffer size (bytes)
+	mailbuffer[c++] = 8; // Req. + value length (bytes)
+	mailbuffer[c++] = 0; // X offset
+	mailbuffer[c++] = 0; // Y offset
+
+	mailbuffer[c++] = 0; // Terminating tag
+
+	mailbuffer[0] = c*4; // Buffer size
+
+	uint32_t *buf = Mailbox::call(Mailbox::PROPERTY, mailbuffer);
+
+	/* Valid response with the requested physical size? */
+	if (buf[1] != 0x80000000) return FAIL_SET_SCALE;
+	if (buf[4] != 0x80000008) return FAIL_SET_SCALE;
+	if (buf[5] != width || buf[6] != height) return FAIL_SET_SCALE;
+
+	fb.scale = scale;
+	fb.width = width;
+	fb.height = height;
+	fb.draw = 0;
+	fb.shown = 0;
 	return SUCCESS;
     }
+
+    Error show(uint32_t page) {
+	if (page >= fb.pages) return FAIL_INVALID_PAGE;
+	if (page == fb.shown) return SUCCESS;
+
+	uint32_t mailbuffer[8] __attribute__((aligned(64)));
+	mailbuffer[0] = 8 * 4; // Total size
+	mailbuffer[1] = 0; // Request
+	mailbuffer[2] = 0x00048009; // Tag id (set virtual offset)
+	mailbuffer[3] = 8; // Value buffer size (bytes)
+	mailbuffer[4] = 8; // Req. + value length (bytes)
+	mailbuffer[5] = 0; // X offset
+	mailbuffer[6] = page * fb.display_height; // Y offset
+	mailbuffer[7] = 0; // End tag
+
+	uint32_t *buf = Mailbox::call(Mailbox::PROPERTY, mailbuffer);
+
+	if (buf[1] != 0x80000000) return FAIL_SHOW_PAGE;
+	if (buf[6] != page * fb.display_height) return FAIL_SHOW_PAGE;
+
+	fb.shown = page;
+	return SUCCESS;
+    }
+
+    void map(void) {
+	if (fb.base == 0) return;
+	// the scanout never sees the data cache, stores coalesce in the
+	// write buffer instead
+	uint32_t start = fb.base & ~(MMU::PAGE_SIZE - 1);
+	uint32_t end = (fb.base + fb.size + MMU::PAGE_SIZE - 1)
+	    & ~(MMU::PAGE_SIZE - 1);
+	MMU::map_range(start, start, end - start,
+		       MMU::WRITE_COMBINE, MMU::EXECUTE_NEVER);
+    }
 }
 
@@ -32,27 +32,138 @@ namespace Framebuffer {
 	FAIL_INVALID_TAG_RESPONSE,
 	FAIL_INVALID_TAG_DATA,
 	FAIL_INVALID_PITCH_RESPONSE,
-	FAIL_INVALID_PITCH_DATA
+	FAIL_INVALID_PITCH_DATA,
+	FAIL_INVALID_SCALE,
+	FAIL_SET_SCALE,
+	FAIL_INVALID_DEPTH,
+	FAIL_INVALID_PAGE,
+	FAIL_SHOW_PAGE,
     };
 
-    struct Pixel {
-	uint8_t red;
-	uint8_t green;
-	uint8_t blue;
-	uint8_t alpha;
+    enum {
+	// pages of display size stacked in the virtual framebuffer, the
+	// firmware may give us fewer
+	MAX_PAGES = 3,
     };
-    
+
+    /* Pixel formats
+     * Every format has one bit per pixel the renderer may use to tag
+     * pixels (e.g. as computed). Colors made with rgb() are tagged.
+     */
+
+    // 32 bpp, the alpha channel serves as tag
+    struct RGBA8888 {
+	enum { DEPTH = 32 };
+
+	struct Pixel {
+	    uint8_t red;
+	    uint8_t green;
+	    uint8_t blue;
+	    uint8_t alpha;
+
+	    bool operator ==(const Pixel &q) const {
+		return (red == q.red) && (green == q.green)
+		    && (blue == q.blue) && (alpha == q.alpha);
+	    }
+	    bool operator !=(const Pixel &q) const {
+		return !(*this == q);
+	    }
+	};
+
+	static Pixel rgb(uint8_t r, uint8_t g, uint8_t b) {
+	    Pixel p = {r, g, b, 0xff};
+	    return p;
+	}
+	static uint8_t red(Pixel p) { return p.red; }
+	static uint8_t green(Pixel p) { return p.green; }
+	static uint8_t blue(Pixel p) { return p.blue; }
+	static bool tagged(Pixel p) { return p.alpha == 0xff; }
+	static Pixel untag(Pixel p) {
+	    p.alpha = 0x80;
+	    return p;
+	}
+    };
+
+    // 16 bpp, 5 bit red, 6 bit green, 5 bit blue
+    // the lowest green bit serves as tag
+    struct RGB565 {
+	enum { DEPTH = 16 };
+	enum { TAG = 1 << 5 };
+
+	typedef uint16_t Pixel;
+
+	static Pixel rgb(uint8_t r, uint8_t g, uint8_t b) {
+	    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3) | TAG;
+	}
+	static uint8_t red(Pixel p) {
+	    return ((p >> 11) << 3) | (p >> 13);
+	}
+	static uint8_t green(Pixel p) {
+	    return (((p >> 5) & 0x3f) << 2) | ((p >> 9) & 3);
+	}
+	static uint8_t blue(Pixel p) {
+	    return ((p & 0x1f) << 3) | ((p >> 2) & 7);
+	}
+	static bool tagged(Pixel p) { return p & TAG; }
+	static Pixel untag(Pixel p) { return p & ~TAG; }
+    };
+
     struct FB {
 	uint32_t base;
 	uint32_t size; // in bytes
 	uint32_t pitch; // in bytes
-	uint32_t width;
+	uint32_t width; // render resolution
 	uint32_t height;
+	uint32_t display_width; // native display resolution
+	uint32_t display_height;
+	uint32_t scale; // display pixels per framebuffer pixel
+	uint32_t depth; // bits per pixel
+	uint32_t pages; // pages available, each display_height lines
+	uint32_t draw; // page Surface draws to
+	uint32_t shown; // page on screen
     };
 
     extern FB fb;
 
-    Error init(void);
+    // Typed view of the framebuffer in a given pixel format.
+    // Takes a copy of the geometry, rebuild it after set_scale().
+    template<typename Format>
+    struct Surface {
+	typedef typename Format::Pixel Pixel;
+
+	uint32_t base;
+	uint32_t pitch; // in bytes
+	uint32_t width;
+	uint32_t height;
+
+	Surface(const FB &f)
+	    : base(f.base + f.draw * f.display_height * f.pitch),
+	      pitch(f.pitch), width(f.width), height(f.height) { }
+
+	Pixel * row(uint32_t y) const {
+	    return (Pixel *)(base + y * pitch);
+	}
+
+	Pixel & at(uint32_t x, uint32_t y) const {
+	    return row(y)[x];
+	}
+    };
+
+    // allocate a framebuffer for the full display, render at 1/scale
+    // depth is 32 (RGBA8888) or 16 (RGB565)
+    Error init(uint32_t scale = 1, uint32_t depth = 32);
+
+    // change the render resolution to 1/scale of the display,
+    // the firmware scales the smaller framebuffer up to the display
+    // also shows and draws to page 0 again
+    Error set_scale(uint32_t scale);
+
+    // scan out a different page, takes effect with the next frame
+    Error show(uint32_t page);
+
+    // map the framebuffer write-combining (normal, non-cacheable,
+    // bufferable), call after MMU::init_page_table()
+    void map(void);
 }
 
 #endif // #ifndef KERNEL_FRAMEBUFFER_H
@@ -21,7 +21,7 @@
 
 #include "gpio.h"
 #include "peripherals.h"
-#include "delay.h"
+#include "time.h"
 
 namespace GPIO {
     enum {
@@ -63,16 +63,16 @@ namespace GPIO {
     }
 
     void set_pull_up_down(uint32_t pin, PullUpDown action) {
-        // set action & delay for 150 cycles.
+        // set action & wait 150 cycles (of at most 250MHz).
 	volatile uint32_t *pud = reg(GPIO_PUD);
 	*pud = action;
-	delay(150);
+	Time::delay_us(1);
 
-	// trigger action & delay for 150 cycles.
+	// trigger action & wait 150 cycles.
 	volatile uint32_t *clock =
 	    reg((pin < 32) ? GPIO_PUDCLK0 : GPIO_PUDCLK1);
 	*clock = (1 << (pin % 32));
-	delay(150);
+	Time::delay_us(1);
 
 	// clear action
 	*pud = OFF;
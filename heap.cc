@@ -0,0 +1,298 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Kernel heap for the Raspberry Pi
+ *
+ * Small sizes are rounded up to a power of two and carved out of slabs,
+ * one page per slab with a header at the start of the page. Each core
+ * keeps a magazine of free objects per size class, a core only takes the
+ * class lock when its magazine runs empty or full. Larger sizes get
+ * whole pages straight from the page allocator with the header in front.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "heap.h"
+#include "memory.h"
+#include "smp.h"
+#include "irq.h"
+#include "sync.h"
+#include "stdio.h"
+
+namespace Heap {
+    enum {
+	MIN_SHIFT = 4,
+	SLAB_MAGIC = 0x51AB51AB,
+	LARGE_MAGIC = 0x1A4E1A4E,
+	HEADER_SIZE = 64, // keeps objects cache line aligned
+
+	MAGAZINE_SIZE = 16,
+	MAGAZINE_BATCH = MAGAZINE_SIZE / 2,
+	CACHE_LINE = 64,
+    };
+
+    struct Object {
+	Object *next;
+    };
+
+    // at the start of every slab page
+    struct Slab {
+	uint32_t magic;
+	uint32_t cls;
+	uint32_t used; // objects not on the slab free list
+	Object *free;
+	Slab *next; // partial slabs of the class
+	Slab *prev;
+    };
+
+    // at the start of every large allocation
+    struct Large {
+	uint32_t magic;
+	uint32_t pages;
+    };
+
+    struct Class {
+	Sync::MCSLock lock;
+	uint32_t slabs;
+	Slab *partial;
+    } __attribute__((aligned(CACHE_LINE)));
+
+    struct Magazine {
+	uint32_t count;
+	Object *objects[MAGAZINE_SIZE];
+    };
+
+    // only ever touched by its own core
+    struct Core {
+	Magazine magazines[NUM_CLASSES];
+	uint32_t allocs[NUM_CLASSES];
+	uint32_t frees[NUM_CLASSES];
+    } __attribute__((aligned(CACHE_LINE)));
+
+    static Class classes[NUM_CLASSES];
+    static Core cores[SMP::NUM_CORES];
+    static Sync::Atomic<uint32_t> large_allocs;
+    static Sync::Atomic<uint32_t> large_frees;
+    static Sync::Atomic<uint32_t> large_pages;
+
+    static uint32_t size_class(size_t size) {
+	if (size <= (1U << MIN_SHIFT)) return 0;
+	// round up to the next power of two
+	return 32 - __builtin_clz(size - 1) - MIN_SHIFT;
+    }
+
+    static uint32_t class_size(uint32_t cls) {
+	return 1U << (cls + MIN_SHIFT);
+    }
+
+    static Slab * slab_of(void *ptr) {
+	return (Slab *)((uint32_t)ptr & ~(Memory::PAGE_SIZE - 1));
+    }
+
+    // new slab with all objects on its free list, class lock held
+    static Slab * new_slab(uint32_t cls) {
+	Slab *slab = (Slab *)Memory::alloc_page();
+	if (slab == 0) return 0;
+	uint32_t size = class_size(cls);
+	slab->magic = SLAB_MAGIC;
+	slab->cls = cls;
+	slab->used = 0;
+	slab->free = 0;
+	uint8_t *base = (uint8_t *)slab;
+	for (uint32_t off = Memory::PAGE_SIZE - size; off >= HEADER_SIZE; off -= size) {
+	    Object *obj = (Object *)&base[off];
+	    obj->next = slab->free;
+	    slab->free = obj;
+	}
+	++classes[cls].slabs;
+	return slab;
+    }
+
+    static void link(Class &c, Slab *slab) {
+	slab->prev = 0;
+	slab->next = c.partial;
+	if (c.partial) c.partial->prev = slab;
+	c.partial = slab;
+    }
+
+    static void unlink(Class &c, Slab *slab) {
+	if (slab->prev) {
+	    slab->prev->next = slab->next;
+	} else {
+	    c.partial = slab->next;
+	}
+	if (slab->next) slab->next->prev = slab->prev;
+    }
+
+    // fill half the magazine from partial slabs
+    static void refill(uint32_t cls, Magazine &mag) {
+	Class &c = classes[cls];
+	Sync::MCSGuard guard(c.lock);
+	while (mag.count < MAGAZINE_BATCH) {
+	    Slab *slab = c.partial;
+	    if (slab == 0) {
+		slab = new_slab(cls);
+		if (slab == 0) break;
+		link(c, slab);
+	    }
+	    while (slab->free && mag.count < MAGAZINE_BATCH) {
+		Object *obj = slab->free;
+		slab->free = obj->next;
+		++slab->used;
+		mag.objects[mag.count++] = obj;
+	    }
+	    // full slabs are not kept on any list
+	    if (slab->free == 0) unlink(c, slab);
+	}
+    }
+
+    // return half the magazine to the slabs
+    static void drain(uint32_t cls, Magazine &mag) {
+	Class &c = classes[cls];
+	Sync::MCSGuard guard(c.lock);
+	for (uint32_t n = 0; n < MAGAZINE_BATCH; ++n) {
+	    Object *obj = mag.objects[--mag.count];
+	    Slab *slab = slab_of(obj);
+	    if (slab->free == 0) link(c, slab);
+	    obj->next = slab->free;
+	    slab->free = obj;
+	    if (--slab->used == 0 && c.partial != slab) {
+		// empty and not the only slab to allocate from
+		unlink(c, slab);
+		slab->magic = 0;
+		--c.slabs;
+		Memory::free_page(slab);
+	    }
+	}
+    }
+
+    static void * alloc_large(size_t size) {
+	uint32_t pages = (size + HEADER_SIZE + Memory::PAGE_SIZE - 1) / Memory::PAGE_SIZE;
+	Large *large;
+	if (pages == 1) {
+	    large = (Large *)Memory::alloc_page();
+	} else {
+	    large = (Large *)Memory::alloc_pages(pages);
+	}
+	if (large == 0) return 0;
+	large->magic = LARGE_MAGIC;
+	large->pages = pages;
+	// statistics only, no ordering needed
+	large_allocs.fetch_add(1, Sync::RELAXED);
+	large_pages.fetch_add(pages, Sync::RELAXED);
+	return (uint8_t *)large + HEADER_SIZE;
+    }
+
+    static void free_large(Large *large) {
+	uint32_t pages = large->pages;
+	large->magic = 0;
+	if (pages == 1) {
+	    Memory::free_page(large);
+	} else {
+	    Memory::free_pages(large, pages);
+	}
+	large_frees.fetch_add(1, Sync::RELAXED);
+	large_pages.fetch_sub(pages, Sync::RELAXED);
+    }
+
+    void * alloc(size_t size) {
+	if (size > MAX_SMALL) return alloc_large(size);
+	uint32_t cls = size_class(size);
+	// no preemption or migration while the core's magazine changes
+	uint32_t flags = IRQ::save_disable();
+	Core &core = cores[SMP::core_id()];
+	Magazine &mag = core.magazines[cls];
+	if (mag.count == 0) {
+	    refill(cls, mag);
+	    if (mag.count == 0) {
+		IRQ::restore(flags);
+		return 0;
+	    }
+	}
+	++core.allocs[cls];
+	void *ptr = mag.objects[--mag.count];
+	IRQ::restore(flags);
+	return ptr;
+    }
+
+    void free(void *ptr) {
+	if (ptr == 0) return;
+	Slab *slab = slab_of(ptr);
+	if (slab->magic == LARGE_MAGIC) {
+	    free_large((Large *)slab);
+	    return;
+	}
+	if (slab->magic != SLAB_MAGIC) {
+	    puts("Heap::free: bad pointer ");
+	    put_uint32((uint32_t)ptr);
+	    putc('\n');
+	    return;
+	}
+	uint32_t cls = slab->cls;
+	uint32_t flags = IRQ::save_disable();
+	Core &core = cores[SMP::core_id()];
+	Magazine &mag = core.magazines[cls];
+	if (mag.count == MAGAZINE_SIZE) drain(cls, mag);
+	mag.objects[mag.count++] = (Object *)ptr;
+	++core.frees[cls];
+	IRQ::restore(flags);
+    }
+
+    void stats(Stats &s) {
+	for (uint32_t cls = 0; cls < NUM_CLASSES; ++cls) {
+	    s.allocs[cls] = 0;
+	    s.frees[cls] = 0;
+	    for (uint32_t i = 0; i < SMP::NUM_CORES; ++i) {
+		s.allocs[cls] += cores[i].allocs[cls];
+		s.frees[cls] += cores[i].frees[cls];
+	    }
+	    s.slabs[cls] = classes[cls].slabs;
+	}
+	s.large_allocs = large_allocs.load(Sync::RELAXED);
+	s.large_frees = large_frees.load(Sync::RELAXED);
+	s.large_pages = large_pages.load(Sync::RELAXED);
+    }
+
+    void dump(void) {
+	Stats s;
+	stats(s);
+	printf("Heap:  size     allocs      frees      slabs\n");
+	for (uint32_t cls = 0; cls < NUM_CLASSES; ++cls) {
+	    printf("      %5lu %10lu %10lu %10lu\n", class_size(cls),
+		   s.allocs[cls], s.frees[cls], s.slabs[cls]);
+	}
+	printf("      large %10lu %10lu %10lu pages\n",
+	       s.large_allocs, s.large_frees, s.large_pages);
+    }
+}
+
+void * operator new(size_t size) {
+    return Heap::alloc(size);
+}
+
+void * operator new[](size_t size) {
+    return Heap::alloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    Heap::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    Heap::free(ptr);
+}
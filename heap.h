@@ -0,0 +1,53 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Kernel heap for the Raspberry Pi
+ */
+
+#ifndef KERNEL_HEAP_H
+#define KERNEL_HEAP_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Heap {
+    enum {
+	NUM_CLASSES = 7, // 16, 32, ..., 1024 bytes
+	MAX_SMALL = 1024,
+	ALIGN = 16, // every allocation is aligned to this
+    };
+
+    // returns 0 when out of memory
+    void * alloc(size_t size);
+    void free(void *ptr);
+
+    struct Stats {
+	uint32_t allocs[NUM_CLASSES]; // all cores
+	uint32_t frees[NUM_CLASSES];
+	uint32_t slabs[NUM_CLASSES]; // pages used for each class
+	uint32_t large_allocs;
+	uint32_t large_frees;
+	uint32_t large_pages; // pages currently used for large allocations
+    };
+
+    void stats(Stats &stats);
+    // print statistics
+    void dump(void);
+}
+
+#endif // #ifndef KERNEL_HEAP_H
@@ -0,0 +1,131 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Inter-processor messages for the Raspberry Pi 2
+ */
+
+#include <stdint.h>
+#include "ipi.h"
+#include "irq.h"
+#include "smp.h"
+#include "ring.h"
+#include "barriers.h"
+#include "stdio.h"
+#include "time.h"
+#include "trace.h"
+
+namespace IPI {
+    enum {
+	// BCM2836 local mailboxes, 4 per core
+	MAILBOX_SET   = 0x40000080, // + 0x10 * core, write 1 to set
+	MAILBOX_CLEAR = 0x400000C0, // + 0x10 * core, read, write 1 to clear
+
+	RING_SIZE = 16,
+    };
+
+    constexpr volatile uint32_t * mailbox_set(uint32_t core) {
+	return (volatile uint32_t *)(MAILBOX_SET + 0x10 * core);
+    }
+
+    constexpr volatile uint32_t * mailbox_clear(uint32_t core) {
+	return (volatile uint32_t *)(MAILBOX_CLEAR + 0x10 * core);
+    }
+
+    struct Message {
+	Type type;
+	uint32_t arg;
+	uint32_t stamp; // Time::ticks(), the same on all cores
+    };
+
+    struct Stats {
+	uint32_t received[NUM_TYPES];
+	uint64_t latency;	// sum over all messages
+	uint32_t max_latency;
+    };
+
+    // rings[from][to]
+    static Ring<Message, RING_SIZE> rings[SMP::NUM_CORES][SMP::NUM_CORES];
+    static handler_t handlers[NUM_TYPES];
+    // only written by the receiving core
+    static Stats stats[SMP::NUM_CORES];
+
+    static void handle_irq(uint32_t, void *) {
+	uint32_t core = SMP::core_id();
+	Stats &s = stats[core];
+	// clear first, a message posted after this sets the bit again
+	uint32_t senders = *mailbox_clear(core);
+	*mailbox_clear(core) = senders;
+	data_memory_barrier();
+	while(senders) {
+	    uint32_t from = __builtin_ctz(senders);
+	    senders &= senders - 1;
+	    Message msg;
+	    while(rings[from][core].pop(msg)) {
+		uint32_t latency = (uint32_t)Time::ticks() - msg.stamp;
+		++s.received[msg.type];
+		s.latency += latency;
+		if (latency > s.max_latency) s.max_latency = latency;
+		Trace::record(Trace::IPI_RECEIVE, msg.type, from);
+		handler_t handler = handlers[msg.type];
+		if (handler) handler(from, msg.arg);
+	    }
+	}
+    }
+
+    void init_core(void) {
+	uint32_t core = SMP::core_id();
+	*mailbox_clear(core) = ~0U;
+	IRQ::set_handler(IRQ::MAILBOX0, handle_irq, 0);
+	IRQ::enable(IRQ::MAILBOX0);
+    }
+
+    void set_handler(Type type, handler_t handler) {
+	handlers[type] = handler;
+	data_memory_barrier();
+    }
+
+    void post(uint32_t core, Type type, uint32_t arg) {
+	uint32_t self = SMP::core_id();
+	Ring<Message, RING_SIZE> &ring = rings[self][core];
+	// our own IRQ handlers may post to the same core
+	uint32_t flags = IRQ::save_disable();
+	while(!ring.push(Message{type, arg, (uint32_t)Time::ticks()})) {
+	    // the receiver drains it from its IRQ handler
+	    IRQ::restore(flags);
+	    flags = IRQ::save_disable();
+	}
+	IRQ::restore(flags);
+	// the message must be in memory before the interrupt arrives
+	data_sync_barrier();
+	*mailbox_set(core) = 1U << self;
+    }
+
+    void print_stats(void) {
+	puts("IPI       work   wake cancel  stats  avg/max latency [ns]\n");
+	for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+	    const Stats &s = stats[core];
+	    uint32_t total = 0;
+	    for (uint32_t t = 0; t < NUM_TYPES; ++t) total += s.received[t];
+	    printf("core %lu%7lu%7lu%7lu%7lu%8llu/%llu\n", core,
+		   s.received[WORK], s.received[WAKE], s.received[CANCEL],
+		   s.received[STATS],
+		   Time::ticks_to_ns(total ? s.latency / total : 0),
+		   Time::ticks_to_ns(s.max_latency));
+	}
+    }
+}
@@ -0,0 +1,57 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Inter-processor messages for the Raspberry Pi 2
+ *
+ * Every pair of cores has a ring of messages, posting one sets the
+ * sender's bit in the receiver's local mailbox 0, which raises an IRQ
+ * there. Handlers run in interrupt context on the receiving core.
+ */
+
+#ifndef KERNEL_IPI_H
+#define KERNEL_IPI_H 1
+
+#include <stdint.h>
+
+namespace IPI {
+    enum Type {
+	WORK,	// start on a work item, arg is user defined
+	WAKE,	// no action, just leave IRQ::wait()
+	CANCEL,	// stop the current work item
+	STATS,	// report back, arg is user defined
+	PARK,	// never returns, the core waits for a new kernel
+	NUM_TYPES
+    };
+
+    typedef void (*handler_t)(uint32_t from, uint32_t arg);
+
+    // every core: clear and enable the calling core's mailbox 0, needs
+    // IRQ::init_core()
+    void init_core(void);
+
+    // handlers are shared by all cores
+    void set_handler(Type type, handler_t handler);
+
+    // waits only while the ring to that core is full
+    void post(uint32_t core, Type type, uint32_t arg);
+
+    // messages handled per core and their delivery latency
+    void print_stats(void);
+}
+
+#endif // #ifndef KERNEL_IPI_H
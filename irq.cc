@@ -0,0 +1,301 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Interrupts for the Raspberry Pi 2
+ *
+ * The BCM2836 local interrupt controller signals per-core sources
+ * (timers, mailboxes, PMU) and cascades the BCM2835 interrupt
+ * controller (GPU and ARM peripherals) to one core.
+ */
+
+#include <stdint.h>
+#include "irq.h"
+#include "peripherals.h"
+#include "smp.h"
+#include "sync.h"
+#include "barriers.h"
+#include "stdio.h"
+#include "uart.h"
+#include "sched.h"
+
+extern "C" {
+    extern uint32_t vectors[];
+    void irq_handler(uint32_t fiq);
+    void exception_handler(uint32_t type, uint32_t ret, uint32_t *regs);
+}
+
+namespace IRQ {
+    enum {
+	// BCM2835 interrupt controller
+	BASIC_PENDING = 0xB200,
+	PENDING1      = 0xB204,
+	PENDING2      = 0xB208,
+	FIQ_CONTROL   = 0xB20C,
+	ENABLE1       = 0xB210,
+	ENABLE2       = 0xB214,
+	ENABLE_BASIC  = 0xB218,
+	DISABLE1      = 0xB21C,
+	DISABLE2      = 0xB220,
+	DISABLE_BASIC = 0xB224,
+
+	// basic pending: pending 1 / 2 have bits, bits 10-20 are
+	// shortcuts for some of those
+	BASIC_ARM_MASK = 0xFF,
+	BASIC_GPU_MASK = 0x1FFF00,
+
+	// BCM2836 local interrupt controller
+	LOCAL_PERIPHERALS = 0x40000000,
+	GPU_ROUTING       = 0x0C,
+	PMU_ROUTING_SET   = 0x10,
+	PMU_ROUTING_CLR   = 0x14,
+	LOCAL_TIMER_ROUTE = 0x24,
+	LOCAL_TIMER_CTRL  = 0x34,
+	TIMER_CONTROL     = 0x40, // + 4 * core
+	MAILBOX_CONTROL   = 0x50, // + 4 * core
+	IRQ_SOURCE        = 0x60, // + 4 * core
+	FIQ_SOURCE        = 0x70, // + 4 * core
+
+	// control register bits, IRQ in 0-3, FIQ in 4-7
+	FIQ_SHIFT = 4,
+	LOCAL_TIMER_IRQ_ENABLE = 1 << 29,
+    };
+
+    constexpr volatile uint32_t * local(uint32_t offset) {
+	return (volatile uint32_t *)(LOCAL_PERIPHERALS + offset);
+    }
+
+    struct Handler {
+	handler_t fn;
+	void *arg;
+    };
+
+    static Handler handlers[NUM_IRQS];
+    // handlers running on each core
+    static uint32_t nesting[SMP::NUM_CORES];
+    // GPU 0-31, GPU 32-63, ARM; the pending registers don't mask
+    static Sync::Atomic<uint32_t> enabled[3];
+
+    void init(void) {
+	*Peripherals::reg(DISABLE1) = ~0U;
+	*Peripherals::reg(DISABLE2) = ~0U;
+	*Peripherals::reg(DISABLE_BASIC) = ~0U;
+	*Peripherals::reg(FIQ_CONTROL) = 0;
+	for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+	    *local(TIMER_CONTROL + 4 * core) = 0;
+	    *local(MAILBOX_CONTROL + 4 * core) = 0;
+	}
+	*local(PMU_ROUTING_CLR) = 0xFF;
+	*local(LOCAL_TIMER_CTRL) = 0;
+	route(0);
+    }
+
+    void init_core(void) {
+	// VBAR
+	asm volatile ("mcr p15, 0, %0, c12, c0, 0" :: "r" (vectors));
+	instruction_barrier();
+	enable_interrupts();
+    }
+
+    void set_handler(uint32_t irq, handler_t handler, void *arg) {
+	if (irq >= NUM_IRQS) return;
+	uint32_t flags = save_disable();
+	handlers[irq].fn = 0;
+	handlers[irq].arg = arg;
+	data_memory_barrier();
+	handlers[irq].fn = handler;
+	restore(flags);
+    }
+
+    // read-modify-write of the calling core's control registers
+    static void local_control(uint32_t irq, bool on, uint32_t shift) {
+	uint32_t core = SMP::core_id();
+	uint32_t bit = irq - LOCAL_BASE;
+	volatile uint32_t *reg;
+	switch (irq) {
+	case CNTPS: case CNTPNS: case CNTHP: case CNTV:
+	    reg = local(TIMER_CONTROL + 4 * core);
+	    break;
+	case MAILBOX0: case MAILBOX1: case MAILBOX2: case MAILBOX3:
+	    reg = local(MAILBOX_CONTROL + 4 * core);
+	    bit -= MAILBOX0 - LOCAL_BASE;
+	    break;
+	case PMU:
+	    *local(on ? PMU_ROUTING_SET : PMU_ROUTING_CLR) =
+		1U << (core + shift);
+	    return;
+	case LOCAL_TIMER:
+	    if (on) {
+		*local(LOCAL_TIMER_ROUTE) = core + shift;
+		*local(LOCAL_TIMER_CTRL) |= LOCAL_TIMER_IRQ_ENABLE;
+	    } else {
+		*local(LOCAL_TIMER_CTRL) &= ~LOCAL_TIMER_IRQ_ENABLE;
+	    }
+	    return;
+	default:
+	    // GPU cascade and AXI are not switchable
+	    return;
+	}
+	uint32_t flags = save_disable();
+	if (on) {
+	    *reg |= 1U << (bit + shift);
+	} else {
+	    *reg &= ~((1U << (bit + FIQ_SHIFT)) | (1U << bit));
+	}
+	restore(flags);
+    }
+
+    void enable(uint32_t irq) {
+	if (irq < BASIC_BASE) {
+	    enabled[irq / 32].fetch_or(1U << (irq % 32), Sync::RELEASE);
+	    *Peripherals::reg(irq < 32 ? ENABLE1 : ENABLE2) = 1U << (irq % 32);
+	} else if (irq < LOCAL_BASE) {
+	    enabled[2].fetch_or(1U << (irq - BASIC_BASE), Sync::RELEASE);
+	    *Peripherals::reg(ENABLE_BASIC) = 1U << (irq - BASIC_BASE);
+	} else if (irq < NUM_IRQS) {
+	    local_control(irq, true, 0);
+	}
+    }
+
+    void disable(uint32_t irq) {
+	if (irq < BASIC_BASE) {
+	    *Peripherals::reg(irq < 32 ? DISABLE1 : DISABLE2) = 1U << (irq % 32);
+	    enabled[irq / 32].fetch_and(~(1U << (irq % 32)), Sync::RELEASE);
+	} else if (irq < LOCAL_BASE) {
+	    *Peripherals::reg(DISABLE_BASIC) = 1U << (irq - BASIC_BASE);
+	    enabled[2].fetch_and(~(1U << (irq - BASIC_BASE)), Sync::RELEASE);
+	} else if (irq < NUM_IRQS) {
+	    local_control(irq, false, 0);
+	}
+    }
+
+    void enable_fiq(uint32_t irq) {
+	if (irq >= LOCAL_BASE && irq < NUM_IRQS) {
+	    local_control(irq, true, FIQ_SHIFT);
+	}
+    }
+
+    void route(uint32_t core) {
+	// bits 0-1 IRQ core, bits 2-3 FIQ core
+	*local(GPU_ROUTING) = core | core << 2;
+    }
+
+    bool in_handler(void) {
+	return nesting[SMP::core_id()] > 0;
+    }
+
+    static void dispatch(uint32_t irq) {
+	Handler &h = handlers[irq];
+	if (h.fn) {
+	    h.fn(irq, h.arg);
+	} else {
+	    // nobody clears the source, don't take it again
+	    puts("IRQ: no handler for ");
+	    put_dec(irq, 0);
+	    putc('\n');
+	    disable(irq);
+	}
+    }
+
+    static void dispatch_bits(uint32_t base, uint32_t pending) {
+	while (pending) {
+	    uint32_t bit = __builtin_ctz(pending);
+	    pending &= pending - 1;
+	    dispatch(base + bit);
+	}
+    }
+
+    static void dispatch_gpu(void) {
+	uint32_t basic = *Peripherals::reg(BASIC_PENDING);
+	dispatch_bits(BASIC_BASE,
+		      basic & BASIC_ARM_MASK & enabled[2].load(Sync::RELAXED));
+	if (basic & BASIC_GPU_MASK) {
+	    uint32_t p1 = *Peripherals::reg(PENDING1);
+	    uint32_t p2 = *Peripherals::reg(PENDING2);
+	    dispatch_bits(GPU_BASE, p1 & enabled[0].load(Sync::RELAXED));
+	    dispatch_bits(GPU_BASE + 32, p2 & enabled[1].load(Sync::RELAXED));
+	}
+    }
+}
+
+void irq_handler(uint32_t fiq) {
+    using namespace IRQ;
+    uint32_t core = SMP::core_id();
+    uint32_t source = *local((fiq ? FIQ_SOURCE : IRQ_SOURCE) + 4 * core);
+    ++nesting[core];
+    while (source) {
+	uint32_t bit = __builtin_ctz(source);
+	source &= source - 1;
+	if (LOCAL_BASE + bit == GPU) {
+	    dispatch_gpu();
+	} else {
+	    dispatch(LOCAL_BASE + bit);
+	}
+    }
+    --nesting[core];
+    // may switch threads, the rest of the interrupted state is
+    // restored when this one runs again
+    if (!fiq) Sched::preempt();
+}
+
+void exception_handler(uint32_t type, uint32_t ret, uint32_t *regs) {
+    static const char *names[] = {
+	"reset", "undefined instruction", "supervisor call",
+	"prefetch abort", "data abort", "unused vector",
+    };
+    // the return address is this far past the faulting instruction
+    static const uint32_t offsets[] = { 0, 4, 4, 4, 8, 0 };
+    // the UART interrupt may never come again
+    UART::set_polled();
+    puts("\nException: ");
+    puts(names[type]);
+    puts(" on core ");
+    putc('0' + SMP::core_id());
+    puts(" at ");
+    put_uint32(ret - offsets[type]);
+    putc('\n');
+    if (type == IRQ::DATA_ABORT) {
+	uint32_t dfsr, dfar;
+	asm volatile ("mrc p15, 0, %0, c5, c0, 0" : "=r" (dfsr));
+	asm volatile ("mrc p15, 0, %0, c6, c0, 0" : "=r" (dfar));
+	puts("DFSR = ");
+	put_uint32(dfsr);
+	puts(" DFAR = ");
+	put_uint32(dfar);
+	putc('\n');
+    } else if (type == IRQ::PREFETCH_ABORT) {
+	uint32_t ifsr, ifar;
+	asm volatile ("mrc p15, 0, %0, c5, c0, 1" : "=r" (ifsr));
+	asm volatile ("mrc p15, 0, %0, c6, c0, 2" : "=r" (ifar));
+	puts("IFSR = ");
+	put_uint32(ifsr);
+	puts(" IFAR = ");
+	put_uint32(ifar);
+	putc('\n');
+    }
+    for (uint32_t i = 0; i < 13; ++i) {
+	puts(i < 10 ? "r" : "r1");
+	putc('0' + i % 10);
+	puts(" = ");
+	put_uint32(regs[i]);
+	putc((i % 4 == 3) ? '\n' : ' ');
+    }
+    putc('\n');
+    while(true) {
+	asm volatile ("wfe");
+    }
+}
@@ -0,0 +1,135 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Interrupts for the Raspberry Pi 2
+ *
+ * IRQ numbers:
+ *   0 - 63  GPU peripheral interrupts (BCM2835 pending 1 and 2)
+ *  64 - 71  ARM peripheral interrupts (BCM2835 basic pending)
+ *  96 - 107 per-core interrupts (BCM2836 local interrupt controller)
+ */
+
+#ifndef KERNEL_IRQ_H
+#define KERNEL_IRQ_H 1
+
+#include <stdint.h>
+
+namespace IRQ {
+    enum {
+	GPU_BASE = 0,
+	BASIC_BASE = 64,
+	LOCAL_BASE = 96,
+	NUM_IRQS = LOCAL_BASE + 12,
+    };
+
+    enum Number {
+	// GPU peripherals
+	SYSTEM_TIMER1 = GPU_BASE + 1,
+	SYSTEM_TIMER3 = GPU_BASE + 3,
+	DMA0 = GPU_BASE + 16,
+	AUX = GPU_BASE + 29,
+	GPIO0 = GPU_BASE + 49,
+	EMMC = GPU_BASE + 62,
+	UART0 = GPU_BASE + 57,
+
+	// ARM peripherals
+	ARM_TIMER = BASIC_BASE + 0,
+	ARM_MAILBOX = BASIC_BASE + 1,
+	ARM_DOORBELL0 = BASIC_BASE + 2,
+	ARM_DOORBELL1 = BASIC_BASE + 3,
+
+	// per core
+	CNTPS = LOCAL_BASE + 0,   // secure physical timer
+	CNTPNS = LOCAL_BASE + 1,  // non-secure physical timer
+	CNTHP = LOCAL_BASE + 2,   // hypervisor timer
+	CNTV = LOCAL_BASE + 3,    // virtual timer
+	MAILBOX0 = LOCAL_BASE + 4,
+	MAILBOX1 = LOCAL_BASE + 5,
+	MAILBOX2 = LOCAL_BASE + 6,
+	MAILBOX3 = LOCAL_BASE + 7,
+	GPU = LOCAL_BASE + 8,     // cascade, not for handlers
+	PMU = LOCAL_BASE + 9,
+	AXI = LOCAL_BASE + 10,
+	LOCAL_TIMER = LOCAL_BASE + 11,
+    };
+
+    // exception types passed to exception_handler()
+    enum Exception {
+	RESET,
+	UNDEFINED,
+	SUPERVISOR_CALL,
+	PREFETCH_ABORT,
+	DATA_ABORT,
+	UNUSED,
+    };
+
+    typedef void (*handler_t)(uint32_t irq, void *arg);
+
+    // core 0: reset both interrupt controllers, route GPU interrupts
+    // to core 0
+    void init(void);
+
+    // every core: install the vector table and unmask IRQs, needs the
+    // FPU enabled (the entry code saves VFP registers)
+    void init_core(void);
+
+    // called on whatever core takes the interrupt
+    void set_handler(uint32_t irq, handler_t handler, void *arg);
+
+    // GPU and ARM peripheral interrupts are global, per-core
+    // interrupts are enabled for the calling core
+    void enable(uint32_t irq);
+    void disable(uint32_t irq);
+
+    // deliver a per-core interrupt of the calling core as FIQ
+    void enable_fiq(uint32_t irq);
+
+    // send GPU and ARM peripheral interrupts to this core
+    void route(uint32_t core);
+
+    // the calling core is running an interrupt handler
+    bool in_handler(void);
+
+    // CPSR I bit of the calling core
+    static inline uint32_t save_disable(void) {
+	uint32_t cpsr;
+	asm volatile ("mrs %0, cpsr\n\tcpsid i" : "=r" (cpsr) :: "memory");
+	return cpsr;
+    }
+
+    static inline void restore(uint32_t cpsr) {
+	asm volatile ("msr cpsr_c, %0" :: "r" (cpsr) : "memory");
+    }
+
+    static inline void enable_interrupts(void) {
+	asm volatile ("cpsie i" ::: "memory");
+    }
+
+    static inline void disable_interrupts(void) {
+	asm volatile ("cpsid i" ::: "memory");
+    }
+
+    // call with interrupts disabled: sleep until an interrupt is
+    // pending and take it, so a condition checked before can't miss
+    // its wakeup
+    static inline void wait(void) {
+	asm volatile ("wfi\n\tcpsie i\n\tisb\n\tcpsid i" ::: "memory");
+    }
+}
+
+#endif // #ifndef KERNEL_IRQ_H
@@ -0,0 +1,98 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * VideoCore mailbox for the Raspberry Pi 2
+ *
+ * Replies carry no tag of their own, so only one property call may be
+ * in flight. Callers sleep while another thread waits for the VC.
+ */
+
+#include <stdint.h>
+#include "mailbox.h"
+#include "peripherals.h"
+#include "barriers.h"
+#include "cache.h"
+#include "sched.h"
+#include "sync.h"
+
+namespace Mailbox {
+    enum {
+	// Mailbox registers
+	MAILBOX0READ   = 0xb880,
+	MAILBOX0STATUS = 0xb898,
+	MAILBOX0WRITE  = 0xb8a0,
+
+	// ARM physical to VC bus address, L2 cache disabled alias
+	BUS_ALIAS = 0xC0000000,
+	BUS_MASK  = 0x3FFFFFFF,
+    };
+
+    static Sync::Atomic<uint32_t> calling;
+    static Sched::WaitQueue call_wait;
+
+#define MAILBOX(x) (Peripherals::reg(x))
+
+    // Status register
+    enum { SHIFT_EMPTY = 30, SHIFT_FULL };
+    enum Flags {
+	EMPTY = 1 << SHIFT_EMPTY,
+	FULL = 1 << SHIFT_FULL
+    };
+
+    void write(uint32_t chan, const volatile void *buf) {
+	volatile uint32_t *status = MAILBOX(MAILBOX0STATUS);
+	volatile uint32_t *write = MAILBOX(MAILBOX0WRITE);
+	// possibly switching peripheral
+	data_memory_barrier();
+	// wait for mailbox to be not full
+	while(*status & FULL) { }
+	*write = ((uint32_t)buf | BUS_ALIAS) | chan;
+    }
+
+    void * read(uint32_t chan) {
+	volatile uint32_t *status = MAILBOX(MAILBOX0STATUS);
+	volatile uint32_t *read = MAILBOX(MAILBOX0READ);
+	while(true) {
+	    // wait for mailbox to contain something
+	    while(*status & EMPTY) { }
+	    uint32_t res = *read;
+	    if ((res & 0xF) == chan) {
+		// possibly switching peripheral
+		data_memory_barrier();
+		return (void *)(res & ~0xF & BUS_MASK);
+	    }
+	}
+    }
+
+    uint32_t * call(uint32_t chan, uint32_t *buf) {
+	uint32_t size = buf[0];
+	call_wait.wait_until([]() {
+		uint32_t idle = 0;
+		return calling.compare_exchange(idle, 1, Sync::ACQUIRE);
+	    });
+	// the VC reads memory, not our cache
+	Cache::clean_range(buf, size);
+	write(chan, buf);
+	uint32_t *res = (uint32_t *)read(chan);
+	// drop stale lines so we see what the VC wrote
+	Cache::invalidate_range(buf, size);
+	calling.store(0, Sync::RELEASE);
+	call_wait.wake_one();
+	return res;
+    }
+}
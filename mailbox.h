@@ -0,0 +1,48 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * VideoCore mailbox for the Raspberry Pi 2
+ */
+
+#ifndef KERNEL_MAILBOX_H
+#define KERNEL_MAILBOX_H 1
+
+#include <stdint.h>
+
+namespace Mailbox {
+    enum Channel {
+	// property tags, ARM to VC
+	PROPERTY = 8,
+    };
+
+    // send a message buffer (16 byte aligned) to the VC
+    void write(uint32_t chan, const volatile void *buf);
+
+    // wait for a reply on the channel, returns the ARM address
+    void * read(uint32_t chan);
+
+    /* Send a property buffer and wait for the reply
+     * The buffer should be cache line aligned and padded: its lines
+     * are cleaned before and invalidated after the VC writes to it.
+     * buf[0] holds the size of the buffer in bytes.
+     * Calls from several threads are serialized.
+     */
+    uint32_t * call(uint32_t chan, uint32_t *buf);
+}
+
+#endif // #ifndef KERNEL_MAILBOX_H
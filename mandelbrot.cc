@@ -0,0 +1,1520 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Mandelbrot renderer
+ *
+ * Pixels tagged in the framebuffer are computed, untagged pixels are
+ * missing or only guessed. All pixel access is templated on the
+ * framebuffer format so the inner loops know the pixel size at compile
+ * time.
+ */
+
+#include <stdint.h>
+#include "mandelbrot.h"
+#include "framebuffer.h"
+#include "uart.h"
+#include "stdio.h"
+#include "string.h"
+#include "heap.h"
+#include "membench.h"
+#include "boottime.h"
+#include "sync.h"
+#include "smp.h"
+#include "ipi.h"
+#include "sched.h"
+#include "trace.h"
+#include "time.h"
+#include "remote.h"
+#include "qoi.h"
+#include "crc.h"
+#include "tiles.h"
+#include "chainload.h"
+
+namespace Mandelbrot {
+    using Framebuffer::Surface;
+
+    struct Params {
+	volatile double xmin, xmax, ymin, ymax;
+	volatile uint32_t nmax;
+	volatile uint32_t stepx;
+	volatile uint32_t stepy;
+	// compute tagged pixels too, for pages holding an old frame
+	volatile bool redraw;
+	// samples per axis for pixels at the set boundary, 1 = off
+	volatile uint32_t samples;
+	// next line to hand out
+	Sync::Atomic<uint32_t> line;
+	// workers that still have to report back
+	Sync::Atomic<uint32_t> running;
+    };
+    Params params = {
+	-2.5, 1.5, -1.25, 1.25,
+	64,
+	64, 64,
+	false,
+	1,
+	{0},
+	{0},
+    };
+
+    // set by the IPI handlers on the worker's own core
+    struct Worker {
+	volatile bool work;
+	volatile bool cancel;
+    };
+    Worker workers[SMP::NUM_CORES];
+    Sched::WaitQueue work_wait[SMP::NUM_CORES];
+    // core 0 waiting for the workers to report back
+    Sched::WaitQueue done_wait;
+    // lines each core computed for the last picture
+    uint32_t lines_done[SMP::NUM_CORES];
+
+    // render scale used while the user navigates, full resolution
+    // refinement starts once no more input is pending
+    uint32_t interactive_scale = 2;
+
+    // compare colors ignoring the tag
+    template<typename Format>
+    bool same_color(typename Format::Pixel p, typename Format::Pixel q) {
+	return Format::untag(p) == Format::untag(q);
+    }
+
+    // marker for pixels that need computing
+    template<typename Format>
+    typename Format::Pixel gray(void) {
+	return Format::untag(Format::rgb(0x80, 0x80, 0x80));
+    }
+
+    template<typename Format>
+    typename Format::Pixel set_color(uint32_t n) {
+	if (n == params.nmax) {
+	    return Format::rgb(0, 0, 0);
+	} else if (n >= params.nmax / 2) { // white
+	    return Format::rgb(0xff, 0xff, 0xff);
+	} else if (n >= params.nmax / 4) { // yellow -> white
+	    int t = (n - params.nmax / 4) * 255 * 4 / params.nmax;
+	    return Format::rgb(0xff, 0xff, t);
+	} else if (n >= params.nmax / 8) { // red -> yellow
+	    int t = (n - params.nmax / 8) * 255 * 8 / params.nmax;
+	    return Format::rgb(0xff, t, 0);
+	} else if (n >= params.nmax / 16) { // magenta -> red
+	    int t = (n - params.nmax / 16) * 255 * 16 / params.nmax;
+	    return Format::rgb(0xff, 0, 0xff - t);
+	} else if (n >= params.nmax / 32) { // blue -> magenta
+	    int t = (n - params.nmax / 32) * 255 * 32 / params.nmax;
+	    return Format::rgb(t, 0, 0xff);
+	} else if (n >= params.nmax / 64) { // cyan -> blue
+	    int t = (n - params.nmax / 64) * 255 * 64 / params.nmax;
+	    return Format::rgb(0, 0xff - t, 0xff);
+	} else { // green -> cyan
+	    int t = n * 255 * 64 / params.nmax;
+	    return Format::rgb(0, 0xff, t);
+	}
+    }
+
+    template<typename Format>
+    void guess(uint32_t stepx, uint32_t stepy) {
+	typedef typename Format::Pixel Pixel;
+	Surface<Format> fb(Framebuffer::fb);
+	const Pixel black = Format::rgb(0, 0, 0);
+	const Pixel white = Format::rgb(0xff, 0xff, 0xff);
+	Trace::record(Trace::GUESS_START, stepx);
+	// guess gaps
+	for(uint32_t v = 4 * stepy; v + 4 * stepy < fb.height; v += 2 * stepy) {
+	    for(uint32_t u = 4 * stepx; u + 4 * stepx < fb.width; u += 2 * stepx) {
+		Pixel p = fb.at(u, v);
+		if (!Format::tagged(p)) continue;
+		if (p == black || p == white) {
+		    for(uint32_t y = v - 4 * stepy; y <= v + 4 * stepy; y += 2 * stepy) {
+			for(uint32_t x = u - 4 * stepx; x <= u + 4 * stepx; x += 2 * stepx) {
+			    if (x == u && y == v) continue;
+			    if (p != fb.at(x, y)) {
+				goto not_same;
+			    }
+			}
+		    }
+		} else {
+		    for(uint32_t y = v - 2 * stepy; y <= v + 2 * stepy; y += 2 * stepy) {
+			for(uint32_t x = u - 2 * stepx; x <= u + 2 * stepx; x += 2 * stepx) {
+			    if (x == u && y == v) continue;
+			    if (p != fb.at(x, y)) {
+				goto not_same;
+			    }
+			}
+		    }
+		}
+		for(uint32_t y = v - stepy; y <= v + stepy; y += stepy) {
+		    for(uint32_t x = u - stepx; x <= u + stepx; x += stepx) {
+			if (x == u && y == v) continue;
+			fb.at(x, y) = p;
+		    }
+		}
+	    not_same:
+		{}
+	    }
+	}
+	Trace::record(Trace::GUESS_END);
+    }
+
+    const double bailout = 16.0;
+
+    uint32_t escape(double x0, double y0) {
+	uint32_t n = 0;
+	double x = x0, x2 = x0 * x0;
+	double y = y0, y2 = y0 * y0;
+	while (n < params.nmax && x2 + y2 < bailout) {
+	    y = 2 * x * y + y0;
+	    x = x2 - y2 + x0;
+	    y2 = y * y;
+	    x2 = x * x;
+	    ++n;
+	}
+	return n;
+    }
+
+    // natural logarithm within 0.006, plenty for a distance estimate
+    double log_approx(double x) {
+	uint64_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	int32_t e = (int32_t)((bits >> 52) & 0x7FF) - 1023;
+	bits = (bits & ~(0x7FFULL << 52)) | (1023ULL << 52);
+	double m;
+	memcpy(&m, &bits, sizeof(m));
+	// log2 of the mantissa in [1, 2)
+	double t = m - 1;
+	return (e + t * (1.3465 - 0.3465 * t)) * 0.6931471805599453;
+    }
+
+    /* Escape time with the derivative dz/dc alongside z. edge tells if
+     * the distance estimate 0.5 |z| ln|z| / |dz| puts the set boundary
+     * within dist of c. Points in the set are never at the edge.
+     */
+    uint32_t escape_de(double x0, double y0, double dist, bool &edge) {
+	uint32_t n = 0;
+	double x = x0, x2 = x0 * x0;
+	double y = y0, y2 = y0 * y0;
+	// z starts at c, one iteration in
+	double dx = 1, dy = 0;
+	while (n < params.nmax && x2 + y2 < bailout) {
+	    double t = 2 * (x * dx - y * dy) + 1;
+	    dy = 2 * (x * dy + y * dx);
+	    dx = t;
+	    y = 2 * x * y + y0;
+	    x = x2 - y2 + x0;
+	    y2 = y * y;
+	    x2 = x * x;
+	    ++n;
+	}
+	edge = false;
+	if (n < params.nmax) {
+	    // squared to avoid the roots
+	    double r2 = x2 + y2;
+	    double l = 0.25 * log_approx(r2);
+	    edge = r2 * l * l < dist * dist * (dx * dx + dy * dy);
+	}
+	return n;
+    }
+
+    /* Average of samples^2 cells of the pixel (px by py) around c. The
+     * centre sample n stands in for the cell whose corner it is.
+     */
+    template<typename Format>
+    typename Format::Pixel supersample(double x0, double y0, uint32_t n,
+				       uint32_t samples, double px, double py) {
+	typename Format::Pixel c = set_color<Format>(n);
+	uint32_t r = Format::red(c), g = Format::green(c), b = Format::blue(c);
+	for (uint32_t j = 0; j < samples; ++j) {
+	    double y = y0 + ((j + 0.5) / samples - 0.5) * py;
+	    for (uint32_t i = 0; i < samples; ++i) {
+		if (i == samples / 2 && j == samples / 2) continue;
+		double x = x0 + ((i + 0.5) / samples - 0.5) * px;
+		c = set_color<Format>(escape(x, y));
+		r += Format::red(c);
+		g += Format::green(c);
+		b += Format::blue(c);
+	    }
+	}
+	uint32_t num = samples * samples;
+	return Format::rgb(r / num, g / num, b / num);
+    }
+
+    template<typename Format>
+    void mandel_line(uint32_t v) {
+	typedef typename Format::Pixel Pixel;
+	Surface<Format> fb(Framebuffer::fb);
+	double y0 = params.ymin + v * (params.ymax - params.ymin) / fb.height;
+	// pixel size, also the distance that makes a pixel an edge
+	double px = (params.xmax - params.xmin) / fb.width;
+	double py = (params.ymax - params.ymin) / fb.height;
+	uint32_t samples = params.samples;
+	Pixel *row = fb.row(v);
+	Trace::record(Trace::LINE_START, v);
+	for(uint32_t u = 0; u < fb.width; u += params.stepx) {
+	    Pixel *p = &row[u];
+	    if (!params.redraw && Format::tagged(*p)) continue;
+	    double x0 = params.xmin + u * (params.xmax - params.xmin) / fb.width;
+	    if (samples > 1) {
+		// every step computes final pixels, at their own size
+		bool edge;
+		uint32_t n = escape_de(x0, y0, px < py ? px : py, edge);
+		if (edge) {
+		    *p = supersample<Format>(x0, y0, n, samples, px, py);
+		} else {
+		    *p = set_color<Format>(n);
+		}
+	    } else {
+		*p = set_color<Format>(escape(x0, y0));
+	    }
+	}
+	Trace::record(Trace::LINE_END, v);
+    }
+
+    void show_lines(int core, uint32_t lines) {
+	printf("Core %d computed %4lu lines\n", core, lines);
+    }
+
+    void on_work(uint32_t, uint32_t) {
+	uint32_t core = SMP::core_id();
+	Worker &w = workers[core];
+	w.cancel = false;
+	w.work = true;
+	work_wait[core].wake_all();
+    }
+
+    void on_cancel(uint32_t, uint32_t) {
+	workers[SMP::core_id()].cancel = true;
+    }
+
+    // core 0: a worker finished, arg is its line count
+    void on_stats(uint32_t from, uint32_t lines) {
+	lines_done[from] = lines;
+	if (params.running.fetch_sub(1, Sync::RELEASE) == 1) {
+	    done_wait.wake_all();
+	}
+    }
+
+    // sleep until all workers reported back
+    void wait_workers(bool report) {
+	done_wait.wait_until([]() {
+		return params.running.load(Sync::ACQUIRE) == 0;
+	    });
+	if (!report) return;
+	for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+	    show_lines(core, lines_done[core]);
+	}
+    }
+
+    template<typename Format>
+    bool mandelbrot(uint32_t stepx, uint32_t stepy, bool report = true) {
+	params.stepx = stepx;
+	params.stepy = stepy;
+	params.line.store(0, Sync::RELAXED);
+	params.running.store(SMP::NUM_CORES - 1, Sync::RELAXED);
+	Trace::record(Trace::FRAME_START, stepx);
+	// publishes the parameters and guessed pixels
+	for (uint32_t core = 1; core < SMP::NUM_CORES; ++core) {
+	    Trace::record(Trace::WORK_POST, core);
+	    IPI::post(core, IPI::WORK, 0);
+	}
+	// compute missing bits
+	uint32_t v;
+	uint32_t lines = 0;
+	while((v = params.line.fetch_add(params.stepy, Sync::ACQUIRE)) < Framebuffer::fb.height) {
+	    if (UART::poll()) {
+		// abort computaions
+		for (uint32_t core = 1; core < SMP::NUM_CORES; ++core) {
+		    Trace::record(Trace::CANCEL_POST, core);
+		    IPI::post(core, IPI::CANCEL, 0);
+		}
+		lines_done[0] = lines;
+		wait_workers(report);
+		Trace::record(Trace::FRAME_END, 0);
+		return false;
+	    }
+	    mandel_line<Format>(v);
+	    if (++lines == 1) BootTime::mark(BootTime::FIRST_PIXEL);
+	}
+	lines_done[0] = lines;
+	// the workers' pixels are visible once they reported back
+	wait_workers(report);
+	Trace::record(Trace::FRAME_END, 1);
+	return true;
+    }
+
+    template<typename Format>
+    void worker(int core) {
+	Worker &w = workers[core];
+	while(true) {
+	    // sleep until core 0 posts work
+	    work_wait[core].wait_until([&w]() { return w.work; });
+	    w.work = false;
+	    // loop as long as there is work to do
+	    uint32_t v;
+	    uint32_t lines = 0;
+	    while(!w.cancel &&
+		  (v = params.line.fetch_add(params.stepy, Sync::ACQUIRE)) < Framebuffer::fb.height) {
+		++lines;
+		mandel_line<Format>(v);
+	    }
+	    // publishes the pixels, core 0 prints the count
+	    Trace::record(Trace::WORK_DONE, lines);
+	    IPI::post(0, IPI::STATS, lines);
+	}
+    }
+
+    void mandeld(int core) {
+	if (Framebuffer::fb.depth == Framebuffer::RGB565::DEPTH) {
+	    worker<Framebuffer::RGB565>(core);
+	} else {
+	    worker<Framebuffer::RGBA8888>(core);
+	}
+    }
+
+    // A supersampled pixel averages its own area, for a pixel of
+    // another size it is only a guess
+    template<typename Format>
+    typename Format::Pixel keep(typename Format::Pixel p) {
+	return params.samples > 1 ? Format::untag(p) : p;
+    }
+
+    // Switch the framebuffer to a new render scale keeping the computed
+    // samples. Pixel (x, y) at scale s covers the same point as pixel
+    // (x * s, y * s) at scale 1 as long as the display size divides evenly.
+    template<typename Format>
+    void rescale(uint32_t scale) {
+	typedef typename Format::Pixel Pixel;
+	uint32_t old_scale = Framebuffer::fb.scale;
+	if (scale == old_scale) return;
+	uint32_t old_width = Framebuffer::fb.width;
+	uint32_t old_height = Framebuffer::fb.height;
+	if (Framebuffer::set_scale(scale) != Framebuffer::SUCCESS) return;
+	Surface<Format> fb(Framebuffer::fb);
+	// Pixel x sits at x / width of the view. It takes the old pixel at
+	// or before that point, which keeps its tag only if it sits at
+	// exactly the same point. Scales need not divide each other.
+	if (scale < old_scale) {
+	    // expand, walk backwards so no source is overwritten before use
+	    for(int y = fb.height - 1; y >= 0; --y) {
+		uint32_t sy = y * old_height / fb.height;
+		bool exact_y = sy * fb.height == y * old_height;
+		for(int x = fb.width - 1; x >= 0; --x) {
+		    uint32_t sx = x * old_width / fb.width;
+		    Pixel p = fb.at(sx, sy);
+		    bool exact = exact_y && sx * fb.width == x * old_width;
+		    fb.at(x, y) = exact ? keep<Format>(p) : Format::untag(p);
+		}
+	    }
+	} else {
+	    // shrink, walk forward so no source is overwritten before use
+	    for(uint32_t y = 0; y < fb.height; ++y) {
+		uint32_t sy = y * old_height / fb.height;
+		bool exact_y = sy * fb.height == y * old_height;
+		for(uint32_t x = 0; x < fb.width; ++x) {
+		    uint32_t sx = x * old_width / fb.width;
+		    Pixel p = fb.at(sx, sy);
+		    bool exact = exact_y && sx * fb.width == x * old_width;
+		    fb.at(x, y) = exact ? keep<Format>(p) : Format::untag(p);
+		}
+	    }
+	}
+    }
+
+    // mark all pixels as needing computing, keep black as a guess
+    template<typename Format>
+    void invalidate(void) {
+	typedef typename Format::Pixel Pixel;
+	Surface<Format> fb(Framebuffer::fb);
+	const Pixel black = Format::rgb(0, 0, 0);
+	for(uint32_t y = 0; y < fb.height; ++y) {
+	    Pixel *row = fb.row(y);
+	    for(uint32_t x = 0; x < fb.width; ++x) {
+		if (same_color<Format>(row[x], black)) {
+		    row[x] = gray<Format>();
+		} else {
+		    row[x] = Format::untag(row[x]);
+		}
+	    }
+	}
+    }
+
+    // Move the view by (dx, dy) pixels. The overlap is moved with one
+    // memmove per row, only the exposed strips are left to compute.
+    template<typename Format>
+    void pan(int dx, int dy) {
+	typedef typename Format::Pixel Pixel;
+	Surface<Format> fb(Framebuffer::fb);
+	const int width = fb.width;
+	const int height = fb.height;
+	double ux = (params.xmax - params.xmin) / width;
+	double uy = (params.ymax - params.ymin) / height;
+	params.xmin = params.xmin + dx * ux;
+	params.xmax = params.xmax + dx * ux;
+	params.ymin = params.ymin + dy * uy;
+	params.ymax = params.ymax + dy * uy;
+
+	const Pixel marker = gray<Format>();
+	int adx = dx < 0 ? -dx : dx;
+	int ady = dy < 0 ? -dy : dy;
+	if (adx >= width || ady >= height) {
+	    for (int y = 0; y < height; ++y) {
+		Pixel *row = fb.row(y);
+		for (int x = 0; x < width; ++x) row[x] = marker;
+	    }
+	    return;
+	}
+	// kept columns, relative to the new view
+	int keep_from = dx < 0 ? adx : 0;
+	int keep_to = dx < 0 ? width : width - adx;
+	// walk away from the rows still to be read
+	int first = dy < 0 ? height - 1 : 0;
+	int step = dy < 0 ? -1 : 1;
+	for (int y = first; y >= 0 && y < height; y += step) {
+	    Pixel *row = fb.row(y);
+	    int src = y + dy;
+	    if (src < 0 || src >= height) {
+		for (int x = 0; x < width; ++x) row[x] = marker;
+		continue;
+	    }
+	    memmove(&row[keep_from], &fb.row(src)[keep_from + dx],
+		    (keep_to - keep_from) * sizeof(Pixel));
+	    for (int x = 0; x < keep_from; ++x) row[x] = marker;
+	    for (int x = keep_to; x < width; ++x) row[x] = marker;
+	}
+    }
+
+    /* Zoom pyramid
+     * Every zoom in keeps a copy of the view it leaves, so the levels
+     * hold the ancestors of the current view, each covering twice the
+     * area of the next at the same resolution. Zooming out rebuilds the
+     * new view from the current one and the levels: pixels landing on a
+     * computed sample are copied as computed, the rest get the nearest
+     * sample of the finest level covering them as a guess. Only what no
+     * level covers starts out gray.
+     */
+    enum {
+	MAX_LEVELS = 6,
+    };
+
+    struct Level {
+	double xmin, xmax, ymin, ymax;
+	double ux, uy; // pixels per unit
+	uint32_t nmax;
+	uint32_t width, height;
+	void *pixels; // width * height pixels in framebuffer format
+    };
+    Level levels[MAX_LEVELS];
+    uint32_t num_levels;
+
+    void drop_level(uint32_t i) {
+	Heap::free(levels[i].pixels);
+	--num_levels;
+	for (; i < num_levels; ++i) {
+	    levels[i] = levels[i + 1];
+	}
+    }
+
+    void clear_levels(void) {
+	while (num_levels > 0) drop_level(num_levels - 1);
+    }
+
+    // does the level cover exactly the current view?
+    bool same_view(const Level &l) {
+	double eps = (params.xmax - params.xmin) * 1e-9;
+	return l.xmin - params.xmin < eps && params.xmin - l.xmin < eps
+	    && l.xmax - params.xmax < eps && params.xmax - l.xmax < eps
+	    && l.ymin - params.ymin < eps && params.ymin - l.ymin < eps
+	    && l.ymax - params.ymax < eps && params.ymax - l.ymax < eps;
+    }
+
+    void drop_same_view(void) {
+	for (uint32_t i = 0; i < num_levels; ) {
+	    if (same_view(levels[i])) {
+		drop_level(i);
+	    } else {
+		++i;
+	    }
+	}
+    }
+
+    // keep a copy of the current view, the oldest levels go first when
+    // memory runs short
+    template<typename Format>
+    bool push_level(void) {
+	typedef typename Format::Pixel Pixel;
+	Surface<Format> fb(Framebuffer::fb);
+	size_t row_size = fb.width * sizeof(Pixel);
+	drop_same_view();
+	if (num_levels == MAX_LEVELS) drop_level(0);
+	Pixel *pixels;
+	while ((pixels = (Pixel *)Heap::alloc(row_size * fb.height)) == 0) {
+	    if (num_levels == 0) return false;
+	    drop_level(0);
+	}
+	for (uint32_t y = 0; y < fb.height; ++y) {
+	    memcpy(&pixels[y * fb.width], fb.row(y), row_size);
+	}
+	Level &l = levels[num_levels++];
+	l.xmin = params.xmin;
+	l.xmax = params.xmax;
+	l.ymin = params.ymin;
+	l.ymax = params.ymax;
+	l.ux = fb.width / (params.xmax - params.xmin);
+	l.uy = fb.height / (params.ymax - params.ymin);
+	l.nmax = params.nmax;
+	l.width = fb.width;
+	l.height = fb.height;
+	l.pixels = pixels;
+	return true;
+    }
+
+    // is a pixel position close enough to a sample to reuse it?
+    bool on_sample(double f, uint32_t i) {
+	return f - i < 1.0 / 64 && i - f < 1.0 / 64;
+    }
+
+    // build the current view from the levels
+    template<typename Format>
+    void fill_from_levels(void) {
+	typedef typename Format::Pixel Pixel;
+	Surface<Format> fb(Framebuffer::fb);
+	double dx = (params.xmax - params.xmin) / fb.width;
+	double dy = (params.ymax - params.ymin) / fb.height;
+	for (uint32_t y = 0; y < fb.height; ++y) {
+	    Pixel *row = fb.row(y);
+	    double y0 = params.ymin + y * dy;
+	    for (uint32_t x = 0; x < fb.width; ++x) {
+		double x0 = params.xmin + x * dx;
+		Pixel p = gray<Format>();
+		double best = 0;
+		for (uint32_t i = 0; i < num_levels; ++i) {
+		    const Level &l = levels[i];
+		    if (l.nmax != params.nmax) continue;
+		    double fu = (x0 - l.xmin) * l.ux;
+		    double fv = (y0 - l.ymin) * l.uy;
+		    if (fu < -0.5 || fv < -0.5) continue;
+		    uint32_t u = fu + 0.5;
+		    uint32_t v = fv + 0.5;
+		    if (u >= l.width || v >= l.height) continue;
+		    Pixel q = ((const Pixel *)l.pixels)[v * l.width + u];
+		    if (Format::tagged(q) && on_sample(fu, u) && on_sample(fv, v)) {
+			p = keep<Format>(q);
+			break;
+		    }
+		    if (l.ux > best) {
+			// finest level so far
+			p = Format::untag(q);
+			best = l.ux;
+		    }
+		}
+		row[x] = p;
+	    }
+	}
+    }
+
+    /* Tile store
+     * Complete tiles of a finished picture go to the SD card. Tiles of
+     * a new view that are stored come back tagged, so only the rest is
+     * computed. Tiles cut off at the right and bottom edge are never
+     * stored.
+     */
+    uint32_t tile_buf[Tiles::MAX_TILE_BYTES / 4];
+
+    // the Remote engine id computes pixels like the current mode
+    uint8_t engine(void) {
+	switch (params.samples) {
+	case 2: return Remote::ENGINE_DOUBLE_AA4;
+	case 4: return Remote::ENGINE_DOUBLE_AA16;
+	default: return Remote::ENGINE_DOUBLE;
+	}
+    }
+
+    // the top left pixel is computed at exactly these coordinates
+    Tiles::Key tile_key(uint32_t tx, uint32_t ty) {
+	const Framebuffer::FB &f = Framebuffer::fb;
+	Tiles::Key key;
+	memset(&key, 0, sizeof(key));
+	uint32_t u = tx * Tiles::TILE_SIZE;
+	uint32_t v = ty * Tiles::TILE_SIZE;
+	key.x = params.xmin + u * (params.xmax - params.xmin) / f.width;
+	key.y = params.ymin + v * (params.ymax - params.ymin) / f.height;
+	key.dx = (params.xmax - params.xmin) / f.width;
+	key.dy = (params.ymax - params.ymin) / f.height;
+	key.nmax = params.nmax;
+	key.engine = engine();
+	key.depth = f.depth;
+	key.size = Tiles::TILE_SIZE;
+	return key;
+    }
+
+    template<typename Format>
+    bool tile_done(const Surface<Format> &fb, uint32_t tx, uint32_t ty) {
+	for (uint32_t y = 0; y < Tiles::TILE_SIZE; ++y) {
+	    const typename Format::Pixel *row =
+		&fb.row(ty * Tiles::TILE_SIZE + y)[tx * Tiles::TILE_SIZE];
+	    for (uint32_t x = 0; x < Tiles::TILE_SIZE; ++x) {
+		if (!Format::tagged(row[x])) return false;
+	    }
+	}
+	return true;
+    }
+
+    // returns the number of tiles loaded
+    template<typename Format>
+    uint32_t load_tiles(void) {
+	typedef typename Format::Pixel Pixel;
+	if (!Tiles::available()) return 0;
+	Surface<Format> fb(Framebuffer::fb);
+	Pixel *tile = (Pixel *)tile_buf;
+	const uint32_t T = Tiles::TILE_SIZE;
+	uint32_t loaded = 0;
+	for (uint32_t ty = 0; ty < fb.height / T; ++ty) {
+	    for (uint32_t tx = 0; tx < fb.width / T; ++tx) {
+		Tiles::Key key = tile_key(tx, ty);
+		// the tag check is free, the framebuffer read is not
+		if (!Tiles::contains(key) || tile_done(fb, tx, ty)) continue;
+		if (Tiles::load(key, tile, T * T * sizeof(Pixel)) != Tiles::SUCCESS) {
+		    continue;
+		}
+		for (uint32_t y = 0; y < T; ++y) {
+		    memcpy(&fb.row(ty * T + y)[tx * T], &tile[y * T], T * sizeof(Pixel));
+		}
+		++loaded;
+	    }
+	}
+	return loaded;
+    }
+
+    // store the complete tiles that aren't stored yet, Tiles::flush()
+    // writes them out
+    template<typename Format>
+    void save_tiles(void) {
+	typedef typename Format::Pixel Pixel;
+	if (!Tiles::available()) return;
+	Surface<Format> fb(Framebuffer::fb);
+	Pixel *tile = (Pixel *)tile_buf;
+	const uint32_t T = Tiles::TILE_SIZE;
+	for (uint32_t ty = 0; ty < fb.height / T; ++ty) {
+	    for (uint32_t tx = 0; tx < fb.width / T; ++tx) {
+		Tiles::Key key = tile_key(tx, ty);
+		if (Tiles::contains(key) || !tile_done(fb, tx, ty)) continue;
+		for (uint32_t y = 0; y < T; ++y) {
+		    memcpy(&tile[y * T], &fb.row(ty * T + y)[tx * T], T * sizeof(Pixel));
+		}
+		if (Tiles::save(key, tile, T * T * sizeof(Pixel)) != Tiles::SUCCESS) {
+		    return;
+		}
+	    }
+	}
+    }
+
+    // nothing is computed
+    template<typename Format>
+    void untag_all(void) {
+	Surface<Format> fb(Framebuffer::fb);
+	for(uint32_t y = 0; y < fb.height; ++y) {
+	    typename Format::Pixel *row = fb.row(y);
+	    for(uint32_t x = 0; x < fb.width; ++x) {
+		row[x] = Format::untag(row[x]);
+	    }
+	}
+    }
+
+    /* Autopilot
+     * Renders a zoom path frame by frame into the framebuffer pages
+     * while a presenter thread flips them, so the next frame is
+     * computed while the last one is put on screen. Between two
+     * keyframes the view shrinks by a constant factor per frame and
+     * moves so the target centre stays put on screen.
+     */
+
+    struct Keyframe {
+	double cx, cy;	// centre
+	double width;	// of the view in the complex plane
+	uint32_t nmax;
+    };
+
+    // the classic dive into the seahorse valley
+    const Keyframe default_path[] = {
+	{-0.5, 0.0, 3.5, 64},
+	{-0.743643887037151, 0.131825904205330, 0.05, 256},
+	{-0.743643887037151, 0.131825904205330, 1e-5, 1024},
+	{-0.743643887037151, 0.131825904205330, 1e-10, 2048},
+    };
+
+    enum {
+	FRAMES_PER_KEY = 100,
+	MAX_KEYFRAMES = 16,
+    };
+
+    struct Presenter {
+	Sync::Atomic<uint32_t> rendered; // frames handed over
+	Sync::Atomic<uint32_t> presented; // frames on screen
+	Sync::Atomic<uint32_t> running;
+	volatile bool stop;
+	// render start of the frame in each page
+	uint64_t start[Framebuffer::MAX_PAGES];
+	// current report interval, presenter only
+	uint64_t interval_start;
+	uint32_t frames;
+	uint64_t latency_sum;
+	uint64_t latency_min;
+	uint64_t latency_max;
+    };
+    Presenter presenter;
+    Sched::WaitQueue present_wait;
+    Sched::WaitQueue page_wait;
+
+    double to_ms(uint64_t ticks) {
+	return Time::ticks_to_ns(ticks) / 1e6;
+    }
+
+    // fps and latency about once a second
+    void report_frame(Presenter &p, uint64_t now, uint64_t latency) {
+	p.latency_sum += latency;
+	if (p.frames == 0 || latency < p.latency_min) p.latency_min = latency;
+	if (latency > p.latency_max) p.latency_max = latency;
+	++p.frames;
+	uint64_t spent = now - p.interval_start;
+	if (spent < Time::frequency()) return;
+	printf("Autopilot: frame %lu, %.1f fps, latency %.1f/%.1f/%.1f ms avg/min/max\n",
+	       p.presented.load(Sync::RELAXED) + 1,
+	       p.frames * 1000.0 / to_ms(spent), to_ms(p.latency_sum / p.frames),
+	       to_ms(p.latency_min), to_ms(p.latency_max));
+	p.interval_start = now;
+	p.frames = 0;
+	p.latency_sum = 0;
+	p.latency_max = 0;
+    }
+
+    // page 0 is on screen when the autopilot starts, frame 0 goes to
+    // the next one
+    uint32_t frame_page(uint32_t frame) {
+	return (frame + 1) % Framebuffer::fb.pages;
+    }
+
+    void present_loop(void *) {
+	Presenter &p = presenter;
+	p.interval_start = Time::ticks();
+	while(true) {
+	    present_wait.wait_until([&p]() {
+		    return p.stop || p.rendered.load(Sync::ACQUIRE) >
+			p.presented.load(Sync::RELAXED);
+		});
+	    uint32_t frame = p.presented.load(Sync::RELAXED);
+	    // stopped and nothing left to show
+	    if (p.rendered.load(Sync::ACQUIRE) == frame) break;
+	    uint32_t page = frame_page(frame);
+	    Framebuffer::show(page);
+	    uint64_t now = Time::ticks();
+	    report_frame(p, now, now - p.start[page]);
+	    p.presented.store(frame + 1, Sync::RELEASE);
+	    page_wait.wake_all();
+	}
+	p.running.store(0, Sync::RELEASE);
+	page_wait.wake_all();
+    }
+
+    // x^(1/n) by Newton's method, starting above the root so it
+    // converges from there
+    double root(double x, uint32_t n) {
+	double r = 1 + (x - 1) / n;
+	for (int i = 0; i < 100; ++i) {
+	    double p = 1;
+	    for (uint32_t k = 1; k < n; ++k) p *= r;
+	    double next = ((n - 1) * r + x / p) / n;
+	    if (r - next < r * 1e-15) return next;
+	    r = next;
+	}
+	return r;
+    }
+
+    template<typename Format>
+    void autopilot(const Keyframe *path, uint32_t num) {
+	Presenter &p = presenter;
+	const uint32_t pages = Framebuffer::fb.pages;
+	printf("Autopilot: %lu keyframes, %lu pages, any key stops\n", num, pages);
+	p.rendered.store(0, Sync::RELAXED);
+	p.presented.store(0, Sync::RELAXED);
+	p.running.store(1, Sync::RELAXED);
+	p.stop = false;
+	p.frames = 0;
+	p.latency_sum = 0;
+	p.latency_max = 0;
+	if (!Sched::create("present", present_loop, 0, Sched::HIGH)) {
+	    puts("Autopilot: no memory for the presenter\n");
+	    return;
+	}
+	params.redraw = true;
+	uint64_t begin = Time::ticks();
+	uint32_t frame = 0;
+	bool stopped = false;
+	for (uint32_t k = 0; k + 1 < num && !stopped; ++k) {
+	    const Keyframe &a = path[k];
+	    const Keyframe &b = path[k + 1];
+	    double factor = root(b.width / a.width, FRAMES_PER_KEY);
+	    double span = a.width - b.width;
+	    bool zooming = span > a.width * 1e-9 || span < -a.width * 1e-9;
+	    double w = a.width;
+	    for (uint32_t f = 0; f < FRAMES_PER_KEY; ++f, w *= factor) {
+		double t = zooming ? (a.width - w) / span : (double)f / FRAMES_PER_KEY;
+		double cx = a.cx + (b.cx - a.cx) * t;
+		double cy = a.cy + (b.cy - a.cy) * t;
+		double h = w * Framebuffer::fb.height / Framebuffer::fb.width;
+		// the page's last frame must have been replaced on screen,
+		// with a single page wait for the last frame to be shown
+		uint32_t page = frame_page(frame);
+		page_wait.wait_until([&p, frame, pages]() {
+			uint32_t presented = p.presented.load(Sync::ACQUIRE);
+			if (pages == 1) return presented >= frame;
+			return presented + pages >= frame + 2;
+		    });
+		Framebuffer::fb.draw = page;
+		params.xmin = cx - w / 2;
+		params.xmax = cx + w / 2;
+		params.ymin = cy - h / 2;
+		params.ymax = cy + h / 2;
+		params.nmax = a.nmax + (int32_t)(b.nmax - a.nmax) * t;
+		p.start[page] = Time::ticks();
+		// with a tile store only what it lacks is computed,
+		// otherwise the page's old frame is overwritten
+		params.redraw = !Tiles::available();
+		if (!params.redraw) {
+		    untag_all<Format>();
+		    load_tiles<Format>();
+		}
+		if (!mandelbrot<Format>(1, 1, false)) {
+		    stopped = true;
+		    break;
+		}
+		save_tiles<Format>();
+		++frame;
+		p.rendered.store(frame, Sync::RELEASE);
+		present_wait.wake_all();
+	    }
+	}
+	if (stopped) UART::get();
+	Tiles::flush();
+
+	// let the presenter finish, then go back to page 0
+	p.stop = true;
+	present_wait.wake_all();
+	page_wait.wait_until([&p]() {
+		return p.running.load(Sync::ACQUIRE) == 0;
+	    });
+	uint64_t spent = Time::ticks() - begin;
+	printf("Autopilot: %lu frames in %.3f s, %.2f fps sustained\n",
+	       frame, to_ms(spent) / 1000, frame * 1000.0 / to_ms(spent));
+	params.redraw = false;
+	uint32_t last = frame > 0 ? frame_page(frame - 1) : 0;
+	if (last != 0) {
+	    // page 0 gets a copy of what is on screen
+	    Framebuffer::fb.draw = 0;
+	    Surface<Format> dst(Framebuffer::fb);
+	    Framebuffer::fb.draw = last;
+	    Surface<Format> src(Framebuffer::fb);
+	    for (uint32_t y = 0; y < dst.height; ++y) {
+		memcpy(dst.row(y), src.row(y), dst.width * sizeof(typename Format::Pixel));
+	    }
+	    Framebuffer::fb.draw = 0;
+	    Framebuffer::show(0);
+	}
+	Framebuffer::fb.draw = 0;
+    }
+
+    // line editing with echo, true unless it is empty
+    bool read_line(char *buf, uint32_t size) {
+	uint32_t len = 0;
+	while(true) {
+	    char c = UART::get();
+	    if (c == '\r' || c == '\n') break;
+	    if ((c == '\b' || c == 0x7f) && len > 0) {
+		--len;
+		puts("\b \b");
+	    } else if (c >= ' ' && len + 1 < size) {
+		buf[len++] = c;
+		putc(c);
+	    }
+	}
+	putc('\n');
+	buf[len] = 0;
+	return len > 0;
+    }
+
+    void skip_spaces(const char *&s) {
+	while (*s == ' ' || *s == '\t' || *s == ',') ++s;
+    }
+
+    bool parse_double(const char *&s, double &x) {
+	skip_spaces(s);
+	bool negative = *s == '-';
+	if (*s == '-' || *s == '+') ++s;
+	bool digits = false;
+	x = 0;
+	while (*s >= '0' && *s <= '9') {
+	    x = x * 10 + (*s++ - '0');
+	    digits = true;
+	}
+	if (*s == '.') {
+	    ++s;
+	    double scale = 0.1;
+	    while (*s >= '0' && *s <= '9') {
+		x += (*s++ - '0') * scale;
+		scale /= 10;
+		digits = true;
+	    }
+	}
+	if (!digits) return false;
+	if (*s == 'e' || *s == 'E') {
+	    ++s;
+	    bool down = *s == '-';
+	    if (*s == '-' || *s == '+') ++s;
+	    int e = 0;
+	    while (*s >= '0' && *s <= '9') e = e * 10 + (*s++ - '0');
+	    while (e-- > 0) x = down ? x / 10 : x * 10;
+	}
+	if (negative) x = -x;
+	return true;
+    }
+
+    // "cx cy width nmax" per line until an empty one
+    uint32_t read_path(Keyframe *path, uint32_t max) {
+	puts("Keyframes as: centre_x centre_y width nmax, empty line ends\n");
+	uint32_t num = 0;
+	char line[80];
+	while (num < max && read_line(line, sizeof(line))) {
+	    const char *s = line;
+	    Keyframe &k = path[num];
+	    double nmax;
+	    if (!parse_double(s, k.cx) || !parse_double(s, k.cy)
+		|| !parse_double(s, k.width) || !parse_double(s, nmax)
+		|| k.width <= 0 || nmax < 1) {
+		puts("bad keyframe, ignored\n");
+		continue;
+	    }
+	    k.nmax = nmax;
+	    ++num;
+	}
+	return num;
+    }
+
+    /* Remote control
+     * Entered from the key menu when a frame starts, see remote.h. A
+     * render runs the usual passes from step 64 down to 1 and any input
+     * cancels it, so the host should only send CANCEL meanwhile. DATA
+     * carries the framebuffer rows, tag bit included. A capture keeps
+     * going while the host renders.
+     */
+    Remote::Frame request;
+    // last RENDER: time and lines computed by each core over all passes
+    uint64_t render_ticks;
+    uint32_t render_lines[SMP::NUM_CORES];
+
+    template<typename Format>
+    Remote::Error set_view(const Remote::Frame &f) {
+	using namespace Remote;
+	if (f.length != VIEW_SIZE) return FAIL_LENGTH;
+	const uint8_t *p = f.payload;
+	double xmin = get_double(&p[0]);
+	double xmax = get_double(&p[8]);
+	double ymin = get_double(&p[16]);
+	double ymax = get_double(&p[24]);
+	uint32_t nmax = get32(&p[32]);
+	uint8_t engine = p[36];
+	uint8_t scale = p[37];
+	if (!(xmin < xmax) || !(ymin < ymax) || nmax == 0) return FAIL_INVALID_VALUE;
+	if (engine > ENGINE_DOUBLE_AA16) return FAIL_INVALID_VALUE;
+	rescale<Format>(scale);
+	if (Framebuffer::fb.scale != scale) return FAIL_INVALID_VALUE;
+	static const uint32_t samples[] = { 1, 2, 4 };
+	if (nmax != params.nmax || samples[engine] != params.samples) {
+	    clear_levels();
+	}
+	params.samples = samples[engine];
+	params.xmin = xmin;
+	params.xmax = xmax;
+	params.ymin = ymin;
+	params.ymax = ymax;
+	params.nmax = nmax;
+	invalidate<Format>();
+	return SUCCESS;
+    }
+
+    template<typename Format>
+    void render(void) {
+	uint64_t start = Time::ticks();
+	bool completed = true;
+	for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+	    render_lines[core] = 0;
+	}
+	load_tiles<Format>();
+	for (uint32_t step = 64; step > 0 && completed; step /= 2) {
+	    guess<Format>(step, step);
+	    completed = mandelbrot<Format>(step, step, false);
+	    for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+		render_lines[core] += lines_done[core];
+	    }
+	}
+	render_ticks = Time::ticks() - start;
+	if (completed) {
+	    save_tiles<Format>();
+	    Tiles::flush();
+	}
+
+	uint8_t payload[5 + 4 * SMP::NUM_CORES];
+	payload[0] = completed;
+	Remote::put32(&payload[1], Time::ticks_to_ns(render_ticks) / 1000);
+	for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+	    Remote::put32(&payload[5 + 4 * core], render_lines[core]);
+	}
+	Remote::send(Remote::DONE, payload, sizeof(payload));
+    }
+
+    void send_stats(void) {
+	uint8_t payload[12 + 4 * SMP::NUM_CORES];
+	Remote::put16(&payload[0], Framebuffer::fb.width);
+	Remote::put16(&payload[2], Framebuffer::fb.height);
+	Remote::put32(&payload[4], params.nmax);
+	Remote::put32(&payload[8], Time::ticks_to_ns(render_ticks) / 1000);
+	for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+	    Remote::put32(&payload[12 + 4 * core], render_lines[core]);
+	}
+	Remote::send(Remote::STATS, payload, sizeof(payload));
+    }
+
+    template<typename Format>
+    Remote::Error send_data(const Remote::Frame &f) {
+	using namespace Remote;
+	Surface<Format> fb(Framebuffer::fb);
+	if (f.length != 4) return FAIL_LENGTH;
+	uint32_t first = get16(&f.payload[0]);
+	uint32_t rows = get16(&f.payload[2]);
+	if (first + rows > fb.height) return FAIL_INVALID_VALUE;
+	uint32_t size = fb.width * sizeof(typename Format::Pixel);
+	if (size + 5 > MAX_PAYLOAD) return FAIL_LENGTH;
+	for (uint32_t y = first; y < first + rows; ++y) {
+	    uint8_t head[5];
+	    put16(&head[0], y);
+	    put16(&head[2], fb.width);
+	    head[4] = sizeof(typename Format::Pixel);
+	    send(DATA, head, sizeof(head), fb.row(y), size);
+	}
+	return SUCCESS;
+    }
+
+    /* Capture
+     * A LOW priority thread encodes the picture as QOI and sends it in
+     * CAPTURE_DATA frames, so it only runs on cores without rendering to
+     * do. The transmit ring holds it back to the line rate, with flow
+     * control enabled the host can pause it as well.
+     */
+    enum {
+	CAPTURE_CHUNK = 4096,
+    };
+
+    struct Capture {
+	uint32_t x, y, width, height;
+	volatile bool cancel;
+	Sync::Atomic<uint32_t> running;
+	QOI::Encoder encoder;
+	// offset(4) and the QOI bytes of one CAPTURE_DATA frame
+	uint8_t chunk[4 + CAPTURE_CHUNK];
+    };
+    Capture capture;
+    Sched::WaitQueue capture_wait;
+
+    template<typename Format>
+    void capture_loop(void *) {
+	typedef typename Format::Pixel Pixel;
+	Capture &c = capture;
+	Surface<Format> fb(Framebuffer::fb);
+	uint8_t *data = &c.chunk[4];
+	uint32_t offset = 0;
+	uint32_t crc = 0;
+	Remote::Error err = Remote::SUCCESS;
+	c.encoder.init();
+	uint32_t len = QOI::header(data, c.width, c.height);
+	auto send_chunk = [&c, data, &offset, &crc, &len]() {
+	    Remote::put32(c.chunk, offset);
+	    Remote::send(Remote::CAPTURE_DATA, c.chunk, 4 + len);
+	    crc = CRC::crc32(data, len, crc);
+	    offset += len;
+	    len = 0;
+	};
+	for (uint32_t y = c.y; y < c.y + c.height; ++y) {
+	    if (c.cancel) {
+		err = Remote::FAIL_CANCELLED;
+		break;
+	    }
+	    const Pixel *row = fb.row(y);
+	    for (uint32_t x = c.x; x < c.x + c.width; ++x) {
+		Pixel p = row[x];
+		len += c.encoder.put(&data[len], Format::red(p),
+				     Format::green(p), Format::blue(p));
+		if (len + QOI::MAX_PUT_SIZE > CAPTURE_CHUNK) send_chunk();
+	    }
+	}
+	if (err == Remote::SUCCESS) {
+	    // the end marker needs more room than a pixel
+	    if (len + QOI::MAX_FINISH_SIZE > CAPTURE_CHUNK) send_chunk();
+	    len += c.encoder.finish(&data[len]);
+	    send_chunk();
+	}
+	uint8_t end[9];
+	end[0] = err;
+	Remote::put32(&end[1], offset);
+	Remote::put32(&end[5], crc);
+	Remote::send(Remote::CAPTURE_END, end, sizeof(end));
+	c.running.store(0, Sync::RELEASE);
+	capture_wait.wake_all();
+    }
+
+    // CAPTURE: check the rectangle and start the encoder thread
+    template<typename Format>
+    Remote::Error start_capture(const Remote::Frame &f) {
+	using namespace Remote;
+	Capture &c = capture;
+	if (f.length != 8) return FAIL_LENGTH;
+	if (c.running.load(Sync::ACQUIRE)) return FAIL_NOT_NOW;
+	uint32_t width = Framebuffer::fb.width;
+	uint32_t height = Framebuffer::fb.height;
+	c.x = get16(&f.payload[0]);
+	c.y = get16(&f.payload[2]);
+	c.width = get16(&f.payload[4]);
+	c.height = get16(&f.payload[6]);
+	if (c.x >= width || c.y >= height) return FAIL_INVALID_VALUE;
+	// 0 means up to the edge
+	if (c.width == 0) c.width = width - c.x;
+	if (c.height == 0) c.height = height - c.y;
+	if (c.width > width - c.x || c.height > height - c.y) {
+	    return FAIL_INVALID_VALUE;
+	}
+	c.cancel = false;
+	c.running.store(1, Sync::RELAXED);
+	// the ACK goes out before the first chunk
+	ack(f.type, SUCCESS);
+	if (!Sched::create("capture", capture_loop<Format>, 0, Sched::LOW)) {
+	    c.running.store(0, Sync::RELAXED);
+	    uint8_t end[9] = {FAIL_NOT_NOW};
+	    send(CAPTURE_END, end, sizeof(end));
+	}
+	return SUCCESS;
+    }
+
+    // stop a running capture and wait for its CAPTURE_END
+    void stop_capture(void) {
+	capture.cancel = true;
+	capture_wait.wait_until([]() {
+		return capture.running.load(Sync::ACQUIRE) == 0;
+	    });
+    }
+
+    // sync0 was read by the key menu already
+    template<typename Format>
+    void remote(void) {
+	using namespace Remote;
+	bool sync0 = true;
+	while (true) {
+	    Error err = receive(request, 0, sync0);
+	    sync0 = false;
+	    if (err != SUCCESS) {
+		ack(request.type, err);
+		continue;
+	    }
+	    switch(request.type) {
+	    case PING:
+		pong();
+		break;
+	    case SET_VIEW:
+		// the capture reads the framebuffer at the old size
+		if (capture.running.load(Sync::ACQUIRE)) {
+		    ack(request.type, FAIL_NOT_NOW);
+		} else {
+		    ack(request.type, set_view<Format>(request));
+		}
+		break;
+	    case RENDER:
+		render<Format>();
+		break;
+	    case CANCEL:
+		// a running render stopped when the frame arrived
+		if (capture.running.load(Sync::ACQUIRE)) stop_capture();
+		ack(request.type, SUCCESS);
+		break;
+	    case GET_STATS:
+		send_stats();
+		break;
+	    case GET_DATA:
+		ack(request.type, send_data<Format>(request));
+		break;
+	    case SET_BAUD:
+		negotiate_baud(request);
+		break;
+	    case CAPTURE:
+		err = start_capture<Format>(request);
+		if (err != SUCCESS) ack(request.type, err);
+		break;
+	    case SET_FLOW:
+		if (request.length != 1) {
+		    ack(request.type, FAIL_LENGTH);
+		} else {
+		    UART::set_flow_control(request.payload[0]);
+		    ack(request.type, SUCCESS);
+		}
+		break;
+	    case LOAD_BEGIN:
+		ack(request.type, Chainload::begin(request));
+		break;
+	    case LOAD_DATA:
+		ack(request.type, Chainload::data(request));
+		break;
+	    case LOAD_BOOT:
+		err = Chainload::check();
+		if (err == SUCCESS) {
+		    // nothing may write to memory or the card any more
+		    if (capture.running.load(Sync::ACQUIRE)) stop_capture();
+		    Tiles::flush();
+		}
+		ack(request.type, err);
+		if (err == SUCCESS) Chainload::boot();
+		break;
+	    case QUIT:
+		if (capture.running.load(Sync::ACQUIRE)) stop_capture();
+		ack(request.type, SUCCESS);
+		return;
+	    default:
+		ack(request.type, FAIL_UNKNOWN_TYPE);
+	    }
+	}
+    }
+
+    template<typename Format>
+    int zoom(int step) {
+	int zx, zy;
+	double xmin, ymin, xmax, ymax;
+	char c;
+    again:
+	puts("Select [1-9nohjklrxbiptTaA]: ");
+	c = UART::get();
+	Trace::record(Trace::ZOOM, c);
+	if ((uint8_t)c == Remote::SYNC0) {
+	    // a host talks the binary protocol
+	    remote<Format>();
+	    return 64;
+	}
+	printf("%c\n", c);
+	switch(c) {
+	case '1': zx = 0; zy = 2; break;
+	case '2': zx = 1; zy = 2; break;
+	case '3': zx = 2; zy = 2; break;
+	case '4': zx = 0; zy = 1; break;
+	case '5': zx = 1; zy = 1; break;
+	case '6': zx = 2; zy = 1; break;
+	case '7': zx = 0; zy = 0; break;
+	case '8': zx = 1; zy = 0; break;
+	case '9': zx = 2; zy = 0; break;
+	case 'n': goto new_nmax;
+	case 'o': goto zoom_out;
+	case 'h': zx = -1; zy = 0; goto pan_view;
+	case 'l': zx = 1; zy = 0; goto pan_view;
+	case 'k': zx = 0; zy = -1; goto pan_view;
+	case 'j': zx = 0; zy = 1; goto pan_view;
+	case 'r': goto new_scale;
+	case 'x': goto new_samples;
+	case 'b': MemBench::run(); goto again;
+	case 'i': IPI::print_stats(); goto again;
+	case 'p': Sched::dump(); goto again;
+	case 't': Trace::summary(); goto again;
+	case 'T': Trace::dump(); goto again;
+	case 'a':
+	    autopilot<Format>(default_path,
+			      sizeof(default_path) / sizeof(default_path[0]));
+	    clear_levels();
+	    invalidate<Format>();
+	    return 64;
+	case 'A': {
+	    Keyframe path[MAX_KEYFRAMES];
+	    uint32_t num = read_path(path, MAX_KEYFRAMES);
+	    if (num < 2) {
+		puts("Autopilot needs at least 2 keyframes\n");
+		goto again;
+	    }
+	    autopilot<Format>(path, num);
+	    clear_levels();
+	    invalidate<Format>();
+	    return 64;
+	}
+	default:
+	    if (step > 0) {
+		return step;
+	    } else {
+		goto again;
+	    }
+	}
+	// the view we leave becomes an ancestor, taken before rescaling
+	// to keep the full resolution samples
+	push_level<Format>();
+	// navigation renders at the interactive scale again
+	rescale<Format>(interactive_scale);
+	xmin = params.xmin + zx * (params.xmax - params.xmin) / 4;
+	ymin = params.ymin + zy * (params.ymax - params.ymin) / 4;
+	xmax = params.xmin + (zx + 2) * (params.xmax - params.xmin) / 4;
+	ymax = params.ymin + (zy + 2) * (params.ymax - params.ymin) / 4;
+	params.xmin = xmin;
+	params.ymin = ymin;
+	params.xmax = xmax;
+	params.ymax = ymax;
+
+	{
+	    Surface<Format> fb(Framebuffer::fb);
+	    if (zx != 2 || zy != 2) {
+		for(int y = fb.height / 2 - 1; y >= 0; --y) {
+		    int v = y + zy * fb.height / 4;
+		    for(int x = fb.width / 2 - 1; x >= 0; --x) {
+			int u = x + zx * fb.width / 4;
+			fb.at(x + fb.width / 2, y + fb.height / 2) = fb.at(u, v);
+		    }
+		}
+	    }
+	    for(uint32_t y = 0; y < fb.height; ++y) {
+		for(uint32_t x = 0; x < fb.width; ++x) {
+		    if ((x % 2) == 0 && (y % 2) == 0) {
+			fb.at(x, y) = keep<Format>(fb.at(x / 2 + fb.width / 2,
+							 y / 2 + fb.height / 2));
+		    } else {
+			fb.at(x, y) = gray<Format>();
+		    }
+		}
+	    }
+	}
+	if (step == 0) {
+	    step = 1;
+	} else {
+	    step *= 2;
+	    if (step > 64) {
+		step = 64;
+	    }
+	}
+	return step;
+
+    new_nmax:
+	rescale<Format>(interactive_scale);
+	params.nmax *= 2;
+	// the colors depend on nmax
+	clear_levels();
+	invalidate<Format>();
+	return 64;
+    new_samples:
+	// cycle anti-aliasing off -> 4x -> 16x -> off
+	params.samples = params.samples == 1 ? 2 : params.samples == 2 ? 4 : 1;
+	if (params.samples == 1) {
+	    puts("Anti-aliasing off\n");
+	} else {
+	    printf("Anti-aliasing %lux at the set boundary\n",
+		   params.samples * params.samples);
+	}
+	rescale<Format>(interactive_scale);
+	// ancestors hold pixels of the old mode
+	clear_levels();
+	invalidate<Format>();
+	return 64;
+    zoom_out: {
+	// the current view becomes the finest level for the fill
+	bool pushed = push_level<Format>();
+	rescale<Format>(interactive_scale);
+	xmin = params.xmin - (params.xmax - params.xmin) / 2;
+	ymin = params.ymin - (params.ymax - params.ymin) / 2;
+	xmax = params.xmax + (params.xmax - params.xmin) / 2;
+	ymax = params.ymax + (params.ymax - params.ymin) / 2;
+	params.xmin = xmin;
+	params.ymin = ymin;
+	params.xmax = xmax;
+	params.ymax = ymax;
+	if (pushed) {
+	    fill_from_levels<Format>();
+	    drop_level(num_levels - 1);
+	    // an ancestor for this view is in the framebuffer now
+	    drop_same_view();
+	} else {
+	    invalidate<Format>();
+	}
+	return 64;
+    }
+    pan_view: {
+	// an eighth of the view per key press
+	rescale<Format>(interactive_scale);
+	pan<Format>(zx * (int)(Framebuffer::fb.width / 8),
+		    zy * (int)(Framebuffer::fb.height / 8));
+	return 64;
+    }
+    new_scale:
+	// cycle the interactive render scale 1 -> 2 -> 3 -> 1
+	interactive_scale = interactive_scale % 3 + 1;
+	printf("Interactive scale = %lu\n", interactive_scale);
+	if (step > 0) {
+	    return step;
+	} else {
+	    goto again;
+	}
+    }
+
+    template<typename Format>
+    void run(void) {
+	Framebuffer::set_scale(interactive_scale);
+	// nothing is computed yet
+	untag_all<Format>();
+	int step = 64;
+	bool booting = true;
+	while(true) {
+	    // stored tiles of the view need no computing
+	    load_tiles<Format>();
+	    while(step > 0) {
+		printf("Nmax = %lu Step = %d\n", params.nmax, step);
+		guess<Format>(step, step);
+		if (!mandelbrot<Format>(step, step)) break;
+		if (booting) {
+		    // the first picture is up, show where the time went
+		    BootTime::print();
+		    booting = false;
+		}
+		step /= 2;
+	    }
+	    if (step == 0) {
+		save_tiles<Format>();
+		Tiles::flush();
+	    }
+	    if (step == 0 && Framebuffer::fb.scale != 1 && !UART::poll()) {
+		// user stopped navigating, refine at full resolution
+		rescale<Format>(1);
+		step = 64;
+		continue;
+	    }
+	    step = zoom<Format>(step);
+	}
+    }
+
+    void init(void) {
+	IPI::set_handler(IPI::WORK, on_work);
+	IPI::set_handler(IPI::CANCEL, on_cancel);
+	IPI::set_handler(IPI::STATS, on_stats);
+	if (Framebuffer::fb.depth == Framebuffer::RGB565::DEPTH) {
+	    run<Framebuffer::RGB565>();
+	} else {
+	    run<Framebuffer::RGBA8888>();
+	}
+    }
+}
@@ -16,24 +16,18 @@
 */
 
 /*
- * Peripherals helper for the Raspberry Pi
+ * Mandelbrot renderer
  */
 
-#ifndef KERNEL_DELAY_H
-#define KERNEL_DELAY_H 1
+#ifndef KERNEL_MANDELBROT_H
+#define KERNEL_MANDELBROT_H 1
 
-#include <stdint.h>
+namespace Mandelbrot {
+    // interactive renderer, runs on core 0
+    void init(void);
 
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-void delay(uint32_t);
-
-#ifdef __cplusplus
+    // worker loop for the other cores
+    void mandeld(int core);
 }
-#endif
-
-
-#endif // #ifndef KERNEL_DELAY_H
 
+#endif // #ifndef KERNEL_MANDELBROT_H
@@ -0,0 +1,165 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Benchmark for the mem* functions
+ */
+
+#include <stdint.h>
+#include "membench.h"
+#include "string.h"
+#include "stdio.h"
+#include "memory.h"
+#include "mmu.h"
+#include "cache.h"
+#include "framebuffer.h"
+
+namespace MemBench {
+    enum {
+	MAX_SIZE = 256 * 1024,
+	MAX_PAGES = MAX_SIZE / Memory::PAGE_SIZE,
+	// bytes moved per measurement, smaller sizes are repeated
+	TOTAL = 1024 * 1024,
+	// unused virtual address for the uncached alias
+	UNCACHED = 0x90000000,
+    };
+
+    static const uint32_t sizes[] = { 64, 512, 4096, 32768, MAX_SIZE };
+
+    enum Op { MEMCPY, MEMMOVE, MEMSET, MEMCMP, STRLEN };
+
+    static const char *op_names[] = {
+	"memcpy ", "memmove", "memset ", "memcmp ", "strlen ",
+    };
+
+    static void pmu_init(void) {
+	uint32_t pmcr;
+	asm volatile("mrc p15, 0, %0, c9, c12, 0" : "=r" (pmcr));
+	// E: enable counters, C: reset cycle counter
+	pmcr |= 1 | 4;
+	asm volatile("mcr p15, 0, %0, c9, c12, 0" :: "r" (pmcr));
+	// PMCNTENSET, cycle counter
+	asm volatile("mcr p15, 0, %0, c9, c12, 1" :: "r" (1U << 31));
+    }
+
+    static inline uint32_t cycles(void) {
+	uint32_t count;
+	asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r" (count));
+	return count;
+    }
+
+    // bytes per cycle in hundredths
+    static uint32_t measure(Op op, uint8_t *dst, uint8_t *src,
+			    uint32_t size) {
+	uint32_t rounds = TOTAL / size;
+	if (rounds == 0) rounds = 1;
+	volatile uint32_t sink = 0;
+	uint32_t start = cycles();
+	for (uint32_t i = 0; i < rounds; ++i) {
+	    switch (op) {
+	    case MEMCPY:
+		memcpy(dst, src, size);
+		break;
+	    case MEMMOVE:
+		// overlapping, forces the backward copy
+		memmove(dst + 4, dst, size - 4);
+		break;
+	    case MEMSET:
+		memset(dst, i, size);
+		break;
+	    case MEMCMP:
+		sink = memcmp(dst, src, size);
+		break;
+	    case STRLEN:
+		sink = strlen((const char *)dst);
+		break;
+	    }
+	}
+	uint32_t spent = cycles() - start;
+	(void)sink;
+	if (spent == 0) spent = 1;
+	return (uint64_t)rounds * size * 100 / spent;
+    }
+
+    static void report(Op op, const char *dest, uint32_t size,
+		       uint32_t rate) {
+	printf("%s%s%7lu bytes: %2lu.%02lu bytes/cycle\n",
+	       op_names[op], dest, size, rate / 100, rate % 100);
+    }
+
+    static void bench(Op op, const char *dest, uint8_t *dst, uint8_t *src) {
+	for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+	    uint32_t size = sizes[i];
+	    if (op == MEMCMP) {
+		// equal buffers, compares all the way
+		memcpy(dst, src, size);
+	    }
+	    if (op == STRLEN) {
+		memset(dst, 'x', size - 1);
+		dst[size - 1] = 0;
+	    }
+	    report(op, dest, size, measure(op, dst, src, size));
+	}
+    }
+
+    void run(void) {
+	puts("MemBench::run()\n");
+	uint8_t *src = (uint8_t *)Memory::alloc_pages(MAX_PAGES);
+	uint8_t *dst = (uint8_t *)Memory::alloc_pages(MAX_PAGES);
+	uint8_t *save = (uint8_t *)Memory::alloc_pages(MAX_PAGES);
+	if (src == 0 || dst == 0 || save == 0) {
+	    puts("MemBench: out of memory\n");
+	    if (src) Memory::free_pages(src, MAX_PAGES);
+	    if (dst) Memory::free_pages(dst, MAX_PAGES);
+	    if (save) Memory::free_pages(save, MAX_PAGES);
+	    return;
+	}
+	pmu_init();
+	memset(src, 0x5a, MAX_SIZE);
+
+	// cached: ordinary RAM
+	for (uint32_t op = MEMCPY; op <= STRLEN; ++op) {
+	    bench(Op(op), " cached     ", dst, src);
+	}
+
+	// uncached: strongly-ordered alias of the destination
+	Cache::clean_invalidate_range(dst, MAX_SIZE);
+	if (MMU::map_range(UNCACHED, (uint32_t)dst, MAX_SIZE,
+			   MMU::STRONGLY_ORDERED, MMU::EXECUTE_NEVER)) {
+	    uint8_t *alias = (uint8_t *)UNCACHED;
+	    bench(MEMCPY, " uncached   ", alias, src);
+	    bench(MEMMOVE, " uncached   ", alias, src);
+	    bench(MEMSET, " uncached   ", alias, src);
+	    MMU::unmap_range(UNCACHED, MAX_SIZE);
+	}
+
+	// framebuffer: write-combining, restore the picture afterwards
+	Framebuffer::FB &fb = Framebuffer::fb;
+	if (fb.base != 0 && fb.size >= MAX_SIZE) {
+	    uint8_t *screen = (uint8_t *)fb.base;
+	    memcpy(save, screen, MAX_SIZE);
+	    bench(MEMCPY, " framebuffer", screen, src);
+	    bench(MEMMOVE, " framebuffer", screen, src);
+	    bench(MEMSET, " framebuffer", screen, src);
+	    memcpy(screen, save, MAX_SIZE);
+	}
+
+	Memory::free_pages(src, MAX_PAGES);
+	Memory::free_pages(dst, MAX_PAGES);
+	Memory::free_pages(save, MAX_PAGES);
+    }
+}
@@ -0,0 +1,308 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Physical page allocator for the Raspberry Pi
+ *
+ * One bit per page of ARM memory, set bits are free. The bitmap is
+ * protected by a lock. Single pages are handed out from a small per-core
+ * cache that is refilled and drained in batches, so the common case
+ * touches no shared cache line.
+ */
+
+#include <stdint.h>
+#include "memory.h"
+#include "atag.h"
+#include "smp.h"
+#include "irq.h"
+#include "stdio.h"
+#include "string.h"
+#include "sync.h"
+
+namespace Memory {
+    enum {
+	// the BCM2836 can't have more than 1GB
+	MAX_PAGES = (1024 * 1024 * 1024) >> PAGE_SHIFT,
+	// used when the firmware gives no memory information
+	DEFAULT_RAM = 880 * 1024 * 1024,
+	MAX_REGIONS = 8,
+
+	// per-core cache of single pages
+	CACHE_SIZE = 32,
+	CACHE_BATCH = CACHE_SIZE / 2,
+	CACHE_LINE = 64,
+    };
+
+    extern "C" {
+	extern uint8_t _mem_start[];
+	extern uint8_t _mem_end[];
+    }
+
+    static uint32_t bitmap[MAX_PAGES / 32];
+    static uint32_t num_pages;
+    static uint32_t num_free;
+    // word to start the next search at
+    static uint32_t hint;
+    static Sync::TicketLock lock;
+
+#ifdef FAST_BOOT
+    enum {
+	// _mem_end is the next 4MB boundary past the kernel
+	WINDOW_PAGES = (4 * 1024 * 1024) >> PAGE_SHIFT,
+    };
+
+    // The boot code doesn't clear [_mem_start, _mem_end), set bits are
+    // pages there that still need zeroing when first handed out.
+    static Sync::Atomic<uint32_t> unzeroed[WINDOW_PAGES / 32];
+#endif
+
+    struct Cache {
+	uint32_t count;
+	uint32_t pages[CACHE_SIZE];
+    } __attribute__((aligned(CACHE_LINE)));
+
+    static Cache caches[SMP::NUM_CORES];
+
+    // IRQs stay off while the lock is held, on every path, so a
+    // preempted holder can't leave another thread spinning on its core
+    static uint32_t acquire(void) {
+	uint32_t flags = IRQ::save_disable();
+	lock.lock();
+	return flags;
+    }
+
+    static void release(uint32_t flags) {
+	lock.unlock();
+	IRQ::restore(flags);
+    }
+
+    static void mark_free(uint32_t page) {
+	bitmap[page / 32] |= 1U << (page % 32);
+    }
+
+    static void mark_used(uint32_t page) {
+	bitmap[page / 32] &= ~(1U << (page % 32));
+    }
+
+    static void zero(uint32_t page, uint32_t count) {
+#ifdef FAST_BOOT
+	uint32_t first = (uint32_t)_mem_start >> PAGE_SHIFT;
+	for (uint32_t i = 0; i < count; ++i) {
+	    uint32_t n = page + i - first;
+	    if (page + i < first || n >= WINDOW_PAGES) continue;
+	    uint32_t bit = 1U << (n % 32);
+	    // another core may clear a bit in the same word
+	    if (unzeroed[n / 32].fetch_and(~bit, Sync::RELAXED) & bit) {
+		memset((void *)((page + i) << PAGE_SHIFT), 0, PAGE_SIZE);
+	    }
+	}
+#else
+	(void)page;
+	(void)count;
+#endif
+    }
+
+    void init(const void *atags) {
+	ATAG::Region regions[MAX_REGIONS];
+	uint32_t count = ATAG::memory(atags, regions, MAX_REGIONS);
+	if (count == 0) {
+	    puts("Memory: no memory information, assuming default\n");
+	    regions[0].start = 0;
+	    regions[0].size = DEFAULT_RAM;
+	    count = 1;
+	}
+
+	uint32_t end = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+	    puts("Memory: ");
+	    put_uint32(regions[i].start);
+	    puts(" - ");
+	    put_uint32(regions[i].start + regions[i].size);
+	    putc('\n');
+	    uint32_t first = (regions[i].start + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	    uint32_t last = (regions[i].start + regions[i].size) >> PAGE_SHIFT;
+	    if (last > MAX_PAGES) last = MAX_PAGES;
+	    for (uint32_t page = first; page < last; ++page) {
+		mark_free(page);
+	    }
+	    if (last > end) end = last;
+	}
+	num_pages = end;
+
+	// the kernel, its stacks and page tables live below _mem_start
+	uint32_t kernel_end = (uint32_t)_mem_start >> PAGE_SHIFT;
+	for (uint32_t page = 0; page < kernel_end && page < num_pages; ++page) {
+	    mark_used(page);
+	}
+	// a device tree stays in use, a chainloaded kernel gets it too
+	ATAG::Region fdt = ATAG::fdt(atags);
+	if (fdt.size) {
+	    uint32_t first = fdt.start >> PAGE_SHIFT;
+	    uint32_t last = (fdt.start + fdt.size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	    for (uint32_t page = first; page < last && page < num_pages; ++page) {
+		mark_used(page);
+	    }
+	}
+
+	num_free = 0;
+	for (uint32_t i = 0; i < (num_pages + 31) / 32; ++i) {
+	    num_free += __builtin_popcount(bitmap[i]);
+	}
+	hint = kernel_end / 32;
+
+#ifdef FAST_BOOT
+	uint32_t window = ((uint32_t)_mem_end - (uint32_t)_mem_start)
+	    >> PAGE_SHIFT;
+	for (uint32_t n = 0; n < window && n < WINDOW_PAGES; ++n) {
+	    unzeroed[n / 32].fetch_or(1U << (n % 32), Sync::RELAXED);
+	}
+#endif
+
+	puts("Memory: ");
+	put_uint32(num_free);
+	puts(" free pages\n");
+    }
+
+    uint32_t ram_end(void) {
+	return num_pages << PAGE_SHIFT;
+    }
+
+    // find count free pages in [from, to), returns first page or to
+    static uint32_t find_run(uint32_t from, uint32_t to, uint32_t count) {
+	uint32_t run = 0;
+	uint32_t start = from;
+	uint32_t page = from;
+	while (page < to) {
+	    uint32_t word = bitmap[page / 32];
+	    if (page % 32 == 0 && page + 32 <= to) {
+		// skip or take whole words where possible
+		if (word == 0) {
+		    run = 0;
+		    page += 32;
+		    continue;
+		}
+		if (word == ~0U) {
+		    if (run == 0) start = page;
+		    run += 32;
+		    page += 32;
+		    if (run >= count) return start;
+		    continue;
+		}
+	    }
+	    if (word & (1U << (page % 32))) {
+		if (run == 0) start = page;
+		if (++run >= count) return start;
+	    } else {
+		run = 0;
+	    }
+	    ++page;
+	}
+	return to;
+    }
+
+    void * alloc_pages(uint32_t count) {
+	if (count == 0) return 0;
+	uint32_t flags = acquire();
+	uint32_t from = hint * 32;
+	uint32_t page = find_run(from, num_pages, count);
+	if (page == num_pages) {
+	    // wrap around, the run may start before the hint
+	    uint32_t to = from + count;
+	    if (to > num_pages) to = num_pages;
+	    page = find_run(0, to, count);
+	    if (page == to) {
+		release(flags);
+		return 0;
+	    }
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+	    mark_used(page + i);
+	}
+	num_free -= count;
+	hint = (page + count) / 32;
+	release(flags);
+	zero(page, count);
+	return (void *)(page << PAGE_SHIFT);
+    }
+
+    void free_pages(void *pages, uint32_t count) {
+	uint32_t page = (uint32_t)pages >> PAGE_SHIFT;
+	uint32_t flags = acquire();
+	for (uint32_t i = 0; i < count; ++i) {
+	    mark_free(page + i);
+	}
+	num_free += count;
+	release(flags);
+    }
+
+    // move up to CACHE_BATCH pages from the bitmap into the cache
+    static void refill(Cache &cache) {
+	uint32_t words = (num_pages + 31) / 32;
+	uint32_t flags = acquire();
+	uint32_t i = hint;
+	for (uint32_t n = 0; n < words && cache.count < CACHE_BATCH; ++n) {
+	    while (bitmap[i] != 0 && cache.count < CACHE_BATCH) {
+		uint32_t bit = __builtin_ctz(bitmap[i]);
+		bitmap[i] &= ~(1U << bit);
+		--num_free;
+		cache.pages[cache.count++] = (i * 32 + bit) << PAGE_SHIFT;
+	    }
+	    if (cache.count < CACHE_BATCH && ++i >= words) i = 0;
+	}
+	hint = i;
+	release(flags);
+    }
+
+    // move CACHE_BATCH pages from the cache back into the bitmap
+    static void drain(Cache &cache) {
+	uint32_t flags = acquire();
+	for (uint32_t n = 0; n < CACHE_BATCH; ++n) {
+	    mark_free(cache.pages[--cache.count] >> PAGE_SHIFT);
+	}
+	num_free += CACHE_BATCH;
+	release(flags);
+    }
+
+    void * alloc_page(void) {
+	// no preemption or migration while the core's cache changes
+	uint32_t flags = IRQ::save_disable();
+	Cache &cache = caches[SMP::core_id()];
+	if (cache.count == 0) {
+	    refill(cache);
+	    if (cache.count == 0) {
+		IRQ::restore(flags);
+		return 0;
+	    }
+	}
+	uint32_t page = cache.pages[--cache.count];
+	IRQ::restore(flags);
+	zero(page >> PAGE_SHIFT, 1);
+	return (void *)page;
+    }
+
+    void free_page(void *page) {
+	uint32_t flags = IRQ::save_disable();
+	Cache &cache = caches[SMP::core_id()];
+	if (cache.count == CACHE_SIZE) drain(cache);
+	cache.pages[cache.count++] = (uint32_t)page;
+	IRQ::restore(flags);
+    }
+
+    uint32_t free_count(void) {
+	return num_free;
+    }
+}
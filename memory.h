@@ -0,0 +1,53 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Physical page allocator for the Raspberry Pi
+ */
+
+#ifndef KERNEL_MEMORY_H
+#define KERNEL_MEMORY_H 1
+
+#include <stdint.h>
+
+namespace Memory {
+    enum {
+	PAGE_SHIFT = 12,
+	PAGE_SIZE = 1 << PAGE_SHIFT,
+    };
+
+    // find the ARM memory and put everything past the kernel in the
+    // free page bitmap
+    void init(const void *atags);
+
+    // end of ARM memory, the VC memory starts here
+    uint32_t ram_end(void);
+
+    // single pages come from a per-core cache and take no lock unless
+    // the cache runs empty or full
+    void * alloc_page(void);
+    void free_page(void *page);
+
+    // physically contiguous pages, returns 0 if there is no such range
+    void * alloc_pages(uint32_t count);
+    void free_pages(void *pages, uint32_t count);
+
+    // free pages in the bitmap (not counting per-core caches)
+    uint32_t free_count(void);
+}
+
+#endif // #ifndef KERNEL_MEMORY_H
@@ -22,12 +22,34 @@
 #include <stdint.h>
 #include "mmu.h"
 #include "barriers.h"
+#include "memory.h"
+#include "sync.h"
 
-extern uint32_t panic_delay;
 
 namespace MMU {
+    enum {
+	// first-level descriptor types
+	L1_TYPE_MASK   = 0x3,
+	L1_FAULT       = 0x0,
+	L1_PAGE_TABLE  = 0x1,
+	L1_SECTION     = 0x2,
+	L1_SUPER       = 1 << 18,
+
+	L2_SMALL_PAGE  = 0x2,
+
+	// TLB entries to invalidate one by one before flushing everything
+	MAX_FLUSH = 64,
+
+	LEAF_ENTRIES = 256,
+	LEAF_SIZE = LEAF_ENTRIES * 4,
+    };
+
     static volatile __attribute__ ((aligned (0x4000))) uint32_t page_table[4096];
-    static volatile __attribute__ ((aligned (0x400))) uint32_t leaf_table[256];
+    // number of valid entries in the leaf table of each section
+    static uint16_t leaf_used[4096];
+    // free leaf tables, linked through their first entry
+    static uint32_t *leaf_pool;
+    static Sync::TicketLock lock;
 
     struct page {
 	uint8_t data[4096];
@@ -38,61 +60,418 @@ namespace MMU {
 	extern page _mem_end[];
     }
 
-    void init_page_table(void) {
-	uint32_t base;
-	// initialize page_table
-	// 1024MB - 16MB of kernel memory (some belongs to the VC)
-	// default: 880 MB ARM ram, 128MB VC
-	for (base = 0; base < 880; base++) {
-	    // section descriptor (1 MB)
-	    // outer and inner write back, write allocate, shareable (fast but
-	    // unsafe)
-	    page_table[base] = base << 20 | 0x1140E;
+    static void acquire(void) {
+	lock.lock();
+    }
+
+    static void release(void) {
+	lock.unlock();
+    }
+
+    /* second-level descriptor format (small page)
+     * Bit 31: small page base address
+     * ...
+     * Bit 12: small page base address
+     * Bit 11: nG      not global (0 - global)
+     * Bit 10: S       shareable (1 - shareable)
+     * Bit 09: AP[2]   0 (read/write)
+     * Bit 08: TEX[2]  1
+     * Bit 07: TEX[1]  0
+     * Bit 06: TEX[0]  1
+     * Bit 05: AP[1]   0 (only kernel)
+     * Bit 04: AP[0]   0 - access flag
+     * Bit 03: C       0
+     * Bit 02: B       1
+     * Bit 01: 1       1 (small page)
+     * Bit 00: XN      execute never (1 - not executable)
+     *
+     * TEX C B | Description               | Memory type      | Shareable
+     * 000 0 0 | Strongly-ordered          | Strongly-ordered | Shareable
+     * 000 0 1 | Shareable Device          | Device           | Shareable
+     * 000 1 0 | Outer/Inner Write-Through | Normal           | S bit
+     *         | no Write-Allocate         |                  |
+     * 000 1 1 | Outer/inner Write-Back    | Normal           | S bit
+     *         | no Write-Allocate         |                  |
+     * 001 0 0 | Outer/Inner Non-cacheable | Normal           | S bit
+     * 001 0 1 | reserved                  | -                | -
+     * 001 1 0 | IMPL                      | IMPL             | IMPL
+     * 001 1 1 | Outer/inner Write-Back    | Normal           | S bit
+     *         | Write-Allocate            |                  |
+     * 010 0 0 | Non-shareable Device      | Device           | Non-share.
+     * 010 0 1 | reserved                  | -                | -
+     * 010 1 x | reserved                  | -                | -
+     * 011 x x | reserved                  | -                | -
+     * 1BB A A | Cacheable Memory          | Normal           | S bit
+     *         | AA inner / BB outer       |                  |
+     *
+     * Inner/Outer cache attribute encoding
+     * 00 non-cacheable
+     * 01 Write-Back, Write-Allocate
+     * 10 Write-Through, no Write Allocate
+     * 11 Write-Back, no Write Allocate
+     *
+     * AP[2:1] simplified access permission model
+     * 00 read/write, only kernel
+     * 01 read/write, all
+     * 10 read-only, only kernel
+     * 11 read-only, all
+     */
+
+    struct AttrBits {
+	uint8_t tex;
+	uint8_t c;
+	uint8_t b;
+    };
+
+    static const AttrBits attr_bits[] = {
+	{5, 0, 1}, // NORMAL
+	{5, 1, 0}, // WRITE_THROUGH
+	{1, 0, 0}, // WRITE_COMBINE
+	{0, 0, 1}, // DEVICE
+	{0, 0, 0}, // STRONGLY_ORDERED
+    };
+
+    /* first-level descriptor format (section / supersection)
+     * Bit 31: section base address
+     * ...
+     * Bit 20: section base address (supersection: bits 31-24)
+     * Bit 19: NS      0 (secure)
+     * Bit 18: 0 section, 1 supersection
+     * Bit 17: nG      not global
+     * Bit 16: S       shareable
+     * Bit 15: AP[2]   read-only
+     * Bit 14: TEX[2]
+     * Bit 13: TEX[1]
+     * Bit 12: TEX[0]
+     * Bit 11: AP[1]   0 (only kernel)
+     * Bit 10: AP[0]   1 - access flag
+     * Bit 09: IMPL
+     * Bit 08: domain  0 (supersection: extended base address)
+     * ...
+     * Bit 05: domain
+     * Bit 04: XN      execute never
+     * Bit 03: C
+     * Bit 02: B
+     * Bit 01: 1
+     * Bit 00: PXN     0
+     */
+    static uint32_t section_bits(Attr attr, uint32_t flags) {
+	const AttrBits &a = attr_bits[attr];
+	uint32_t desc = L1_SECTION | 1 << 16 | 1 << 10
+	    | a.tex << 12 | a.c << 3 | a.b << 2;
+	if (flags & READ_ONLY) desc |= 1 << 15;
+	if (flags & EXECUTE_NEVER) desc |= 1 << 4;
+	if (flags & NOT_GLOBAL) desc |= 1 << 17;
+	return desc;
+    }
+
+    static uint32_t page_bits(Attr attr, uint32_t flags) {
+	const AttrBits &a = attr_bits[attr];
+	uint32_t desc = L2_SMALL_PAGE | 1 << 10 | 1 << 4
+	    | a.tex << 6 | a.c << 3 | a.b << 2;
+	if (flags & READ_ONLY) desc |= 1 << 9;
+	if (flags & EXECUTE_NEVER) desc |= 1 << 0;
+	if (flags & NOT_GLOBAL) desc |= 1 << 11;
+	return desc;
+    }
+
+    // small page attributes equivalent to a section descriptor
+    static uint32_t section_to_page(uint32_t sec) {
+	uint32_t desc = L2_SMALL_PAGE;
+	desc |= sec & 0xC;                  // C, B
+	desc |= (sec >> 4) & 1;             // XN
+	desc |= ((sec >> 10) & 3) << 4;     // AP[1:0]
+	desc |= ((sec >> 12) & 7) << 6;     // TEX
+	desc |= ((sec >> 15) & 1) << 9;     // AP[2]
+	desc |= ((sec >> 16) & 1) << 10;    // S
+	desc |= ((sec >> 17) & 1) << 11;    // nG
+	return desc;
+    }
+
+    static bool is_section(uint32_t desc) {
+	return (desc & L1_TYPE_MASK) == L1_SECTION && !(desc & L1_SUPER);
+    }
+
+    static bool is_supersection(uint32_t desc) {
+	return (desc & L1_TYPE_MASK) == L1_SECTION && (desc & L1_SUPER);
+    }
+
+    static bool is_page_table(uint32_t desc) {
+	return (desc & L1_TYPE_MASK) == L1_PAGE_TABLE;
+    }
+
+    // TLB entries to invalidate once the page table update is done
+    struct Flush {
+	uint32_t count;
+	bool all;
+	uint32_t mva[MAX_FLUSH];
+
+	void add(uint32_t virt) {
+	    if (count < MAX_FLUSH) {
+		mva[count++] = virt;
+	    } else {
+		all = true;
+	    }
 	}
 
-	// VC ram up to 0x3F000000
-	for (base = 0; base < 1024 - 16; base++) {
-	    // section descriptor (1 MB)
-	    // outer and inner write through, no write allocate, shareable
-	    // page_table[base] = base << 20 | 0x1040A;
-	    // outer write back, write allocate
-	    // inner write through, no write allocate, shareable
-	    page_table[base] = base << 20 | 0x1540A;
+	// invalidate on all cores (inner shareable), one barrier at the end
+	void run(void) {
+	    if (all) {
+		asm volatile("mcr p15, 0, %0, c8, c3, 0" :: "r" (0));
+	    } else {
+		for (uint32_t i = 0; i < count; ++i) {
+		    // TLBIMVAAIS, any ASID
+		    asm volatile("mcr p15, 0, %0, c8, c3, 3"
+				 :: "r" (mva[i] & ~(PAGE_SIZE - 1)));
+		}
+	    }
+	    if (all || count > 0) {
+		data_sync_barrier();
+		instruction_barrier();
+	    }
 	}
+    };
 
-	// unused up to 0x3F000000
-	for (; base < 1024 - 16; base++) {
-	    page_table[base] = 0;
+    // a zeroed leaf table
+    static volatile uint32_t * alloc_leaf(void) {
+	if (leaf_pool == 0) {
+	    // a page holds 4 leaf tables
+	    uint8_t *page = (uint8_t *)Memory::alloc_page();
+	    if (page == 0) return 0;
+	    for (uint32_t off = 0; off < PAGE_SIZE; off += LEAF_SIZE) {
+		uint32_t *leaf = (uint32_t *)&page[off];
+		leaf[0] = (uint32_t)leaf_pool;
+		leaf_pool = leaf;
+	    }
+	}
+	volatile uint32_t *leaf = leaf_pool;
+	leaf_pool = (uint32_t *)leaf_pool[0];
+	for (uint32_t i = 0; i < LEAF_ENTRIES; ++i) {
+	    leaf[i] = 0;
 	}
+	return leaf;
+    }
 
-	// 16 MB peripherals at 0x3F000000
-	for (; base < 1024; base++) {
-	    // shared device, never execute
-	    page_table[base] = base << 20 | 0x10416;
+    static void free_leaf(volatile uint32_t *leaf) {
+	leaf[0] = (uint32_t)leaf_pool;
+	leaf_pool = (uint32_t *)leaf;
+    }
+
+    static volatile uint32_t * leaf_of(uint32_t desc) {
+	return (volatile uint32_t *)(desc & ~(LEAF_SIZE - 1));
+    }
+
+    // turn the supersection covering section idx into 16 sections
+    static void split_supersection(uint32_t idx, Flush &flush) {
+	uint32_t first = idx & ~15;
+	uint32_t desc = page_table[first];
+	uint32_t base = desc & 0xFF000000;
+	uint32_t bits = (desc & 0x000FFFFF) & ~L1_SUPER;
+	for (uint32_t i = 0; i < 16; ++i) {
+	    page_table[first + i] = (base + i * SECTION_SIZE) | bits;
 	}
+	flush.add(first << 20);
+    }
 
-	// 1 MB mailboxes
-	// shared device, never execute
-	page_table[base] = base << 20 | 0x10416;
-	++base;
-	
-	// unused up to 0x7FFFFFFF
-	for (; base < 2048; base++) {
-	    page_table[base] = 0;
+    // clear a first-level entry, freeing its leaf table
+    static void clear_entry(uint32_t idx, Flush &flush) {
+	uint32_t desc = page_table[idx];
+	if (is_page_table(desc)) {
+	    volatile uint32_t *leaf = leaf_of(desc);
+	    for (uint32_t i = 0; i < LEAF_ENTRIES; ++i) {
+		if (leaf[i] & 3) flush.add((idx << 20) + i * PAGE_SIZE);
+	    }
+	    leaf_used[idx] = 0;
+	    free_leaf(leaf);
+	} else if ((desc & L1_TYPE_MASK) != L1_FAULT) {
+	    flush.add(idx << 20);
 	}
+	page_table[idx] = 0;
+    }
+
+    // leaf table for section idx, splitting a (super)section if needed
+    static volatile uint32_t * leaf(uint32_t idx, Flush &flush) {
+	uint32_t desc = page_table[idx];
+	if (is_page_table(desc)) return leaf_of(desc);
+	volatile uint32_t *leaf = alloc_leaf();
+	if (leaf == 0) return 0;
+	if (is_supersection(desc)) {
+	    split_supersection(idx, flush);
+	    desc = page_table[idx];
+	}
+	if (is_section(desc)) {
+	    uint32_t base = desc & 0xFFF00000;
+	    uint32_t bits = section_to_page(desc);
+	    for (uint32_t i = 0; i < LEAF_ENTRIES; ++i) {
+		leaf[i] = (base + i * PAGE_SIZE) | bits;
+	    }
+	    leaf_used[idx] = LEAF_ENTRIES;
+	    flush.add(idx << 20);
+	}
+	// leaf must be visible to the table walk before it is linked
+	data_sync_barrier();
+	page_table[idx] = (uint32_t)leaf | L1_PAGE_TABLE;
+	return leaf;
+    }
 
-	// one second level page tabel (leaf table) at 0x80000000
-	page_table[base++] = (intptr_t)leaf_table | 0x1;
+    bool map_range(uint32_t virt, uint32_t phys, uint32_t size,
+		   Attr attr, uint32_t flags) {
+	if ((virt | phys | size) & (PAGE_SIZE - 1)) return false;
+	uint32_t sec = section_bits(attr, flags);
+	uint32_t pg = page_bits(attr, flags);
+	bool res = true;
+	Flush flush = {0, false, {}};
+	acquire();
+	while (size > 0) {
+	    uint32_t idx = virt >> 20;
+	    if (((virt | phys) & (SUPERSECTION_SIZE - 1)) == 0
+		&& size >= SUPERSECTION_SIZE) {
+		for (uint32_t i = 0; i < 16; ++i) {
+		    clear_entry(idx + i, flush);
+		}
+		for (uint32_t i = 0; i < 16; ++i) {
+		    page_table[idx + i] = phys | L1_SUPER | sec;
+		}
+		virt += SUPERSECTION_SIZE;
+		phys += SUPERSECTION_SIZE;
+		size -= SUPERSECTION_SIZE;
+	    } else if (((virt | phys) & (SECTION_SIZE - 1)) == 0
+		       && size >= SECTION_SIZE) {
+		if (is_supersection(page_table[idx])) {
+		    split_supersection(idx, flush);
+		}
+		clear_entry(idx, flush);
+		page_table[idx] = phys | sec;
+		virt += SECTION_SIZE;
+		phys += SECTION_SIZE;
+		size -= SECTION_SIZE;
+	    } else {
+		volatile uint32_t *l2 = leaf(idx, flush);
+		if (l2 == 0) {
+		    res = false;
+		    break;
+		}
+		uint32_t i = (virt >> 12) & (LEAF_ENTRIES - 1);
+		if (l2[i] & 3) {
+		    flush.add(virt);
+		} else {
+		    ++leaf_used[idx];
+		}
+		l2[i] = phys | pg;
+		virt += PAGE_SIZE;
+		phys += PAGE_SIZE;
+		size -= PAGE_SIZE;
+	    }
+	}
+	// table walk must see the new entries before the TLB is flushed
+	data_sync_barrier();
+	flush.run();
+	release();
+	return res;
+    }
 
-	// 2047MB unused (rest of address space)
-	for (; base < 4096; base++) {
-	    page_table[base] = 0;
+    void unmap_range(uint32_t virt, uint32_t size) {
+	size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	virt &= ~(PAGE_SIZE - 1);
+	Flush flush = {0, false, {}};
+	acquire();
+	while (size > 0) {
+	    uint32_t idx = virt >> 20;
+	    uint32_t desc = page_table[idx];
+	    if (is_supersection(desc)) {
+		if ((virt & (SUPERSECTION_SIZE - 1)) == 0
+		    && size >= SUPERSECTION_SIZE) {
+		    for (uint32_t i = 0; i < 16; ++i) {
+			page_table[idx + i] = 0;
+		    }
+		    flush.add(virt);
+		    virt += SUPERSECTION_SIZE;
+		    size -= SUPERSECTION_SIZE;
+		} else {
+		    split_supersection(idx, flush);
+		}
+		continue;
+	    }
+	    if ((virt & (SECTION_SIZE - 1)) == 0 && size >= SECTION_SIZE) {
+		// whole section, drops a leaf table too
+		clear_entry(idx, flush);
+		virt += SECTION_SIZE;
+		size -= SECTION_SIZE;
+		continue;
+	    }
+	    if ((desc & L1_TYPE_MASK) == L1_FAULT) {
+		virt += PAGE_SIZE;
+		size -= PAGE_SIZE;
+		continue;
+	    }
+	    volatile uint32_t *l2 = leaf(idx, flush);
+	    if (l2 == 0) break; // can't split the section
+	    uint32_t i = (virt >> 12) & (LEAF_ENTRIES - 1);
+	    if (l2[i] & 3) {
+		l2[i] = 0;
+		flush.add(virt);
+		if (--leaf_used[idx] == 0) {
+		    page_table[idx] = 0;
+		    free_leaf(l2);
+		}
+	    }
+	    virt += PAGE_SIZE;
+	    size -= PAGE_SIZE;
 	}
+	data_sync_barrier();
+	flush.run();
+	release();
+    }
+
+    void set_asid(uint32_t asid) {
+	// CONTEXTIDR, the ASID is the low 8 bits
+	asm volatile("mcr p15, 0, %0, c13, c0, 1" :: "r" (asid & 0xFF));
+	instruction_barrier();
+    }
+
+    uint32_t asid(void) {
+	uint32_t contextidr;
+	asm volatile("mrc p15, 0, %0, c13, c0, 1" : "=r" (contextidr));
+	return contextidr & 0xFF;
+    }
+
+    void flush_asid(uint32_t asid) {
+	// TLBIASIDIS
+	asm volatile("mcr p15, 0, %0, c8, c3, 2" :: "r" (asid & 0xFF));
+	data_sync_barrier();
+	instruction_barrier();
+    }
 
-	// initialize leaf_table
-	for (base = 0; base < 256; base++) {
-	    leaf_table[base] = 0;
+    void init_page_table(void) {
+	for (uint32_t i = 0; i < 4096; ++i) {
+	    page_table[i] = 0;
 	}
+
+	// ARM ram as reported by the firmware, the rest up to the
+	// peripherals belongs to the VC
+	uint32_t ram_end = Memory::ram_end();
+	if (ram_end > 0x3F000000) ram_end = 0x3F000000;
+	ram_end &= ~(SECTION_SIZE - 1);
+	// outer write back, write allocate
+	// inner write through, no write allocate, shareable
+	map_range(0, 0, ram_end, WRITE_THROUGH);
+
+	// VC ram up to 0x3F000000
+	// outer write back, write allocate
+	// inner write through, no write allocate, shareable
+	map_range(ram_end, ram_end, 0x3F000000 - ram_end, WRITE_THROUGH);
+
+	// 16 MB peripherals at 0x3F000000
+	// shared device, never execute
+	map_range(0x3F000000, 0x3F000000, SUPERSECTION_SIZE,
+		  DEVICE, EXECUTE_NEVER);
+
+	// 1 MB mailboxes
+	// shared device, never execute
+	map_range(0x40000000, 0x40000000, SECTION_SIZE, DEVICE, EXECUTE_NEVER);
+
+	// everything else is unmapped, including the map() window at
+	// 0x80000000 which gets its leaf table on first use
     }
     
     void init(void) {
@@ -117,6 +496,9 @@ namespace MMU {
 	// write-allocate, cacheable, shareable memory)
 	asm volatile ("mcr p15, 0, %0, c2, c0, 0"
 		      :: "r" (0b1001010 | (unsigned) &page_table));
+	// drop entries from the boot page table (FAST_BOOT)
+	asm volatile ("mcr p15, 0, %0, c8, c7, 0" :: "r" (0));
+	data_sync_barrier();
 	instruction_barrier();
 
 	/* SCTLR
@@ -162,77 +544,15 @@ namespace MMU {
 	mode &= 0x73027827;
 	mode |= 0x20001827;
 	asm volatile ("mcr p15, 0, %0, c1, c0, 0" :: "r" (mode) : "memory");
-
-	// instruction cache makes delay way faster, slow panic down
-	panic_delay = 0x2000000;
     }
 
     void map(uint32_t slot, uint32_t phys_addr) {
-	/* second-level descriptor format (small page)
-	 * Bit 31: small page base address
-	 * ...
-	 * Bit 12: small page base address
-	 * Bit 11: nG      not global (0 - global)
-	 * Bit 10: S       shareable (1 - shareable)
-	 * Bit 09: AP[2]   0 (read/write)
-	 * Bit 08: TEX[2]  1
-	 * Bit 07: TEX[1]  0
-	 * Bit 06: TEX[0]  1
-	 * Bit 05: AP[1]   0 (only kernel)
-	 * Bit 04: AP[0]   0 - access flag
-	 * Bit 03: C       0
-	 * Bit 02: B       1
-	 * Bit 01: 1       1 (small page)
-	 * Bit 00: XN      execute never (1 - not executable)
-	 *
-	 * TEX C B | Description               | Memory type      | Shareable
-	 * 000 0 0 | Strongly-ordered          | Strongly-ordered | Shareable
-	 * 000 0 1 | Shareable Device          | Device           | Shareable
-	 * 000 1 0 | Outer/Inner Write-Through | Normal           | S bit
-	 *         | no Write-Allocate         |                  |
-	 * 000 1 1 | Outer/inner Write-Back    | Normal           | S bit
-	 *         | no Write-Allocate         |                  |
-	 * 001 0 0 | Outer/Inner Non-cacheable | Normal           | S bit
-	 * 001 0 1 | reserved                  | -                | -
-	 * 001 1 0 | IMPL                      | IMPL             | IMPL
-	 * 001 1 1 | Outer/inner Write-Back    | Normal           | S bit
-	 *         | Write-Allocate            |                  |
-	 * 010 0 0 | Non-shareable Device      | Device           | Non-share.
-	 * 010 0 1 | reserved                  | -                | -
-	 * 010 1 x | reserved                  | -                | -
-	 * 011 x x | reserved                  | -                | -
-	 * 1BB A A | Cacheable Memory          | Normal           | S bit
-	 *         | AA inner / BB outer       |                  |
-	 *
-	 * Inner/Outer cache attribute encoding
-	 * 00 non-cacheable
-	 * 01 Write-Back, Write-Allocate
-	 * 10 Write-Through, no Write Allocate
-	 * 11 Write-Back, no Write Allocate
-	 *
-	 * AP[2:1] simplified access permission model
-	 * 00 read/write, only kernel
-	 * 01 read/write, all
-	 * 10 read-only, only kernel
-	 * 11 read-only, all
-	 */
-
 	// outer and inner write back, write allocate, shareable
-	// set accessed bit or the first access gives a fault
-	// RPi/RPi2 do not have hardware support for accessed
-	// 0b0101 0101 0111
-	leaf_table[slot] = phys_addr | 0x557;
-	data_memory_barrier();
+	map_range(0x80000000 + slot * PAGE_SIZE, phys_addr, PAGE_SIZE,
+		  NORMAL, EXECUTE_NEVER);
     }
 
     void unmap(uint32_t slot) {
-	// remove from leaf_table
-	leaf_table[slot] = 0;
-	data_memory_barrier();
-	// invalidate page
-	page *virt = &((page *)0x80000000)[slot];
-	asm volatile("mcr p15, 0, %[ptr], c8, c7, 1"::[ptr]"r"(virt));
-	instruction_barrier();
+	unmap_range(0x80000000 + slot * PAGE_SIZE, PAGE_SIZE);
     }
 }
-
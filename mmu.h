@@ -22,9 +22,49 @@
 #ifndef KERNEL_MMU_H
 #define KERNEL_MMU_H 1
 
+#include <stdint.h>
+
 namespace MMU {
+    enum {
+	PAGE_SIZE = 4096,
+	SECTION_SIZE = 1024 * 1024,
+	SUPERSECTION_SIZE = 16 * 1024 * 1024,
+    };
+
+    // memory types
+    enum Attr {
+	NORMAL,           // outer and inner write back, write allocate
+	WRITE_THROUGH,    // outer write back, inner write through
+	WRITE_COMBINE,    // normal memory, non-cacheable but bufferable
+	DEVICE,           // shared device
+	STRONGLY_ORDERED,
+    };
+
+    enum Flags {
+	READ_ONLY     = 1 << 0,
+	EXECUTE_NEVER = 1 << 1,
+	NOT_GLOBAL    = 1 << 2, // TLB entries are tagged with the ASID
+    };
+
     void init_page_table(void);
     void init(void);
+
+    // Map [virt, virt + size) to [phys, phys + size). All three must be
+    // page aligned. Uses 16MB supersections and 1MB sections wherever
+    // virt and phys are aligned enough, small pages elsewhere. TLB
+    // maintenance is done once for the whole range. Returns false when
+    // out of memory for page tables (the range may be partially mapped).
+    bool map_range(uint32_t virt, uint32_t phys, uint32_t size,
+		   Attr attr, uint32_t flags = 0);
+    void unmap_range(uint32_t virt, uint32_t size);
+
+    // address space id used for NOT_GLOBAL mappings
+    void set_asid(uint32_t asid);
+    uint32_t asid(void);
+    // drop all TLB entries tagged with asid on all cores
+    void flush_asid(uint32_t asid);
+
+    // map/unmap a page at 0x80000000 + slot * 4096
     void map(uint32_t slot, uint32_t phys_addr);
     void unmap(uint32_t slot);
 }
@@ -0,0 +1,68 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Streaming QOI encoder (https://qoiformat.org)
+ */
+
+#include <stdint.h>
+#include "qoi.h"
+
+namespace QOI {
+    enum {
+	CHANNELS_RGB = 3,
+	COLORSPACE_SRGB = 0,
+    };
+
+    void Encoder::init(void) {
+	// zero never matches an opaque color
+	for (uint32_t i = 0; i < INDEX_SIZE; ++i) index[i] = 0;
+	// opaque black
+	prev = 0xFFu << 24;
+	run = 0;
+    }
+
+    uint32_t Encoder::finish(uint8_t *out) {
+	uint32_t len = 0;
+	if (run > 0) {
+	    out[len++] = OP_RUN | (run - 1);
+	    run = 0;
+	}
+	for (uint32_t i = 0; i < END_SIZE - 1; ++i) out[len++] = 0;
+	out[len++] = 1;
+	return len;
+    }
+
+    static void put32be(uint8_t *p, uint32_t x) {
+	p[0] = x >> 24;
+	p[1] = x >> 16;
+	p[2] = x >> 8;
+	p[3] = x;
+    }
+
+    uint32_t header(uint8_t *out, uint32_t width, uint32_t height) {
+	out[0] = 'q';
+	out[1] = 'o';
+	out[2] = 'i';
+	out[3] = 'f';
+	put32be(&out[4], width);
+	put32be(&out[8], height);
+	out[12] = CHANNELS_RGB;
+	out[13] = COLORSPACE_SRGB;
+	return HEADER_SIZE;
+    }
+}
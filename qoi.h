@@ -0,0 +1,106 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Streaming QOI encoder (https://qoiformat.org)
+ *
+ * Pixels go in one at a time, the output comes in small pieces so the
+ * caller can send it as it fills up. Only RGB images, the alpha
+ * channel is always opaque.
+ */
+
+#ifndef KERNEL_QOI_H
+#define KERNEL_QOI_H 1
+
+#include <stdint.h>
+
+namespace QOI {
+    enum {
+	HEADER_SIZE = 14,
+	END_SIZE = 8,
+	// bytes put() writes at most: a finished run and an RGB op
+	MAX_PUT_SIZE = 5,
+	// bytes finish() writes at most
+	MAX_FINISH_SIZE = 1 + END_SIZE,
+	INDEX_SIZE = 64,
+	MAX_RUN = 62,
+
+	OP_INDEX = 0x00,
+	OP_DIFF  = 0x40,
+	OP_LUMA  = 0x80,
+	OP_RUN   = 0xC0,
+	OP_RGB   = 0xFE,
+    };
+
+    struct Encoder {
+	uint32_t index[INDEX_SIZE]; // seen colors as r | g << 8 | b << 16 | a << 24
+	uint32_t prev;
+	uint32_t run;
+
+	void init(void);
+
+	// encode the next pixel, returns the bytes written to out
+	uint32_t put(uint8_t *out, uint8_t r, uint8_t g, uint8_t b) {
+	    uint32_t px = r | g << 8 | b << 16 | 0xFFu << 24;
+	    if (px == prev) {
+		if (++run < MAX_RUN) return 0;
+		out[0] = OP_RUN | (run - 1);
+		run = 0;
+		return 1;
+	    }
+	    uint32_t len = 0;
+	    if (run > 0) {
+		out[len++] = OP_RUN | (run - 1);
+		run = 0;
+	    }
+	    uint32_t hash = (r * 3 + g * 5 + b * 7 + 0xFF * 11) % INDEX_SIZE;
+	    if (index[hash] == px) {
+		out[len++] = OP_INDEX | hash;
+	    } else {
+		index[hash] = px;
+		int8_t dr = r - (uint8_t)prev;
+		int8_t dg = g - (uint8_t)(prev >> 8);
+		int8_t db = b - (uint8_t)(prev >> 16);
+		int8_t dr_dg = dr - dg;
+		int8_t db_dg = db - dg;
+		if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1
+		    && db >= -2 && db <= 1) {
+		    out[len++] = OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+		} else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7
+			   && db_dg >= -8 && db_dg <= 7) {
+		    out[len++] = OP_LUMA | (dg + 32);
+		    out[len++] = (dr_dg + 8) << 4 | (db_dg + 8);
+		} else {
+		    out[len++] = OP_RGB;
+		    out[len++] = r;
+		    out[len++] = g;
+		    out[len++] = b;
+		}
+	    }
+	    prev = px;
+	    return len;
+	}
+
+	// pending run and end marker, returns the bytes written to out
+	uint32_t finish(uint8_t *out);
+    };
+
+    // file header for an RGB image, returns HEADER_SIZE
+    uint32_t header(uint8_t *out, uint32_t width, uint32_t height);
+}
+
+#endif // #ifndef KERNEL_QOI_H
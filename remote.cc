@@ -0,0 +1,158 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Framed binary protocol over the UART
+ *
+ * Frames are received by one thread at a time. Senders sleep while
+ * another thread sends, a spinning sender of higher priority would
+ * keep a preempted one from finishing.
+ */
+
+#include <stdint.h>
+#include "remote.h"
+#include "uart.h"
+#include "crc.h"
+#include "time.h"
+#include "sched.h"
+#include "sync.h"
+#include "string.h"
+
+namespace Remote {
+    static uint8_t out[HEADER_SIZE + MAX_PAYLOAD + CRC_SIZE];
+    static Frame confirm;
+    static Sync::Atomic<uint32_t> sending;
+    static Sched::WaitQueue send_wait;
+
+    // next byte, sleeps in UART::get() when there is no timeout
+    static Error get_byte(uint8_t &c, const Time::Timeout *timeout) {
+	if (timeout) {
+	    while (!UART::poll()) {
+		if (timeout->expired()) return FAIL_TIMEOUT;
+		Sched::yield();
+	    }
+	}
+	c = UART::get();
+	return SUCCESS;
+    }
+
+    Error receive(Frame &frame, uint32_t timeout_us, bool sync0) {
+	Time::Timeout timeout = Time::timeout_us(timeout_us);
+	const Time::Timeout *t = timeout_us ? &timeout : 0;
+	Error err;
+	uint8_t c;
+	while (true) {
+	    // hunt for the sync bytes
+	    while (!sync0) {
+		if ((err = get_byte(c, t)) != SUCCESS) return err;
+		sync0 = c == SYNC0;
+	    }
+	    if ((err = get_byte(c, t)) != SUCCESS) return err;
+	    // a repeated SYNC0 may still start the frame
+	    sync0 = c == SYNC0;
+	    if (c == SYNC1) break;
+	}
+
+	uint8_t header[3];
+	for (uint32_t i = 0; i < sizeof(header); ++i) {
+	    if ((err = get_byte(header[i], t)) != SUCCESS) return err;
+	}
+	frame.type = header[0];
+	frame.length = get16(&header[1]);
+	// garbage, the caller resynchronizes with the next receive
+	if (frame.length > MAX_PAYLOAD) return FAIL_LENGTH;
+	for (uint32_t i = 0; i < frame.length; ++i) {
+	    if ((err = get_byte(frame.payload[i], t)) != SUCCESS) return err;
+	}
+	uint8_t crc[CRC_SIZE];
+	for (uint32_t i = 0; i < CRC_SIZE; ++i) {
+	    if ((err = get_byte(crc[i], t)) != SUCCESS) return err;
+	}
+	uint32_t sum = CRC::crc32(header, sizeof(header));
+	sum = CRC::crc32(frame.payload, frame.length, sum);
+	if (sum != get32(crc)) return FAIL_CRC;
+	return SUCCESS;
+    }
+
+    void send(uint8_t type, const void *head, uint16_t head_len,
+	      const void *data, uint16_t data_len) {
+	uint32_t len = head_len + data_len;
+	if (len > MAX_PAYLOAD) return;
+	send_wait.wait_until([]() {
+		uint32_t idle = 0;
+		return sending.compare_exchange(idle, 1, Sync::ACQUIRE);
+	    });
+	// one write so the frame isn't split by other output
+	out[0] = SYNC0;
+	out[1] = SYNC1;
+	out[2] = type;
+	put16(&out[3], len);
+	memcpy(&out[HEADER_SIZE], head, head_len);
+	if (data_len > 0) memcpy(&out[HEADER_SIZE + head_len], data, data_len);
+	put32(&out[HEADER_SIZE + len], CRC::crc32(&out[2], 3 + len));
+	UART::write((const char *)out, HEADER_SIZE + len + CRC_SIZE);
+	sending.store(0, Sync::RELEASE);
+	send_wait.wake_one();
+    }
+
+    void ack(uint8_t type, Error error) {
+	uint8_t payload[2] = {type, (uint8_t)error};
+	send(ACK, payload, sizeof(payload));
+    }
+
+    void pong(void) {
+	uint8_t payload[3];
+	payload[0] = VERSION;
+	put16(&payload[1], MAX_PAYLOAD);
+	send(PONG, payload, sizeof(payload));
+    }
+
+    Error negotiate_baud(const Frame &frame) {
+	if (frame.length != 4) {
+	    ack(frame.type, FAIL_LENGTH);
+	    return FAIL_LENGTH;
+	}
+	uint32_t rate = get32(frame.payload);
+	if (rate < UART::MIN_BAUD || rate > UART::MAX_BAUD) {
+	    ack(frame.type, FAIL_INVALID_VALUE);
+	    return FAIL_INVALID_VALUE;
+	}
+	uint32_t old = UART::get_baud();
+	ack(frame.type, SUCCESS);
+	if (!UART::set_baud(rate)) {
+	    // the host gives up on the new rate as well
+	    UART::set_baud(old);
+	    return FAIL_INVALID_VALUE;
+	}
+	// the host confirms with a PING at the new rate
+	Time::Timeout deadline = Time::timeout_us(NEGOTIATE_US);
+	Error err;
+	do {
+	    err = receive(confirm, NEGOTIATE_US);
+	} while ((err == FAIL_CRC || err == FAIL_LENGTH) && !deadline.expired());
+	if (err != SUCCESS) {
+	    UART::set_baud(old);
+	    return err;
+	}
+	if (confirm.type == PING) {
+	    pong();
+	} else {
+	    ack(confirm.type, FAIL_NOT_NOW);
+	}
+	return SUCCESS;
+    }
+}
@@ -0,0 +1,167 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Framed binary protocol over the UART
+ *
+ * Every frame is
+ *     0xA5 0x5A type length(2) payload(length) crc(4)
+ * with all numbers little endian and the CRC-32 covering type, length
+ * and payload. Receivers resynchronize on the sync bytes and drop
+ * frames with a bad CRC, so stray text output between frames only
+ * costs the frames it hits.
+ *
+ * Baud negotiation: the board answers SET_BAUD at the old rate, flushes
+ * and switches. The host switches after the reply and must send a frame
+ * within NEGOTIATE_US at the new rate, otherwise the board goes back to
+ * the old one.
+ *
+ * Chainloading: LOAD_BEGIN announces an image, LOAD_DATA frames carry
+ * it in order, each one acknowledged. A frame that isn't acknowledged
+ * is sent again, the board accepts repeats of data it already has.
+ * LOAD_BOOT checks the CRC of the whole image and starts it in place of
+ * the running kernel, which talks at 115200 baud again.
+ */
+
+#ifndef KERNEL_REMOTE_H
+#define KERNEL_REMOTE_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include "string.h"
+
+namespace Remote {
+    enum {
+	SYNC0 = 0xA5,
+	SYNC1 = 0x5A,
+	HEADER_SIZE = 5, // sync, type, length
+	CRC_SIZE = 4,
+	MAX_PAYLOAD = 8192,
+	NEGOTIATE_US = 1000000,
+    };
+
+    // frame types, replies have the top bit set
+    enum Type {
+	PING      = 0x01, // -> PONG
+	SET_VIEW  = 0x02, // View -> ACK
+	RENDER    = 0x03, // -> DONE when finished or cancelled
+	CANCEL    = 0x04, // -> ACK, also cancels a running RENDER
+	GET_STATS = 0x05, // -> STATS
+	GET_DATA  = 0x06, // first row(2), rows(2) -> DATA per row, ACK
+	SET_BAUD  = 0x07, // baud(4) -> ACK at the old rate
+	QUIT      = 0x08, // -> ACK, back to single key commands
+	CAPTURE   = 0x09, // x(2), y(2), width(2), height(2) -> ACK,
+			  // CAPTURE_DATA..., CAPTURE_END
+	SET_FLOW  = 0x0A, // on(1) -> ACK, RTS/CTS on GPIO 16/17
+	LOAD_BEGIN = 0x0B, // size(4), crc(4) of a kernel image -> ACK
+	LOAD_DATA  = 0x0C, // offset(4), image bytes -> ACK, resend on error
+	LOAD_BOOT  = 0x0D, // -> ACK, then the new kernel starts
+
+	ACK       = 0x80, // type(1), Error(1)
+	PONG      = 0x81, // version(1), MAX_PAYLOAD(2)
+	DONE      = 0x82, // completed(1), us(4), lines per core(4 each)
+	STATS     = 0x83, // width(2), height(2), nmax(4), us(4), lines per core(4 each)
+	DATA      = 0x84, // row(2), width(2), bytes per pixel(1), pixels
+	CAPTURE_DATA = 0x85, // offset(4), QOI bytes
+	CAPTURE_END  = 0x86, // Error(1), size(4), crc(4) of the QOI image
+    };
+
+    enum Error {
+	SUCCESS = 0,
+	FAIL_TIMEOUT,
+	FAIL_CRC,
+	FAIL_LENGTH,
+	FAIL_UNKNOWN_TYPE,
+	FAIL_INVALID_VALUE,
+	FAIL_NOT_NOW,
+	FAIL_CANCELLED,
+	FAIL_NO_MEMORY,
+    };
+
+    enum {
+	VERSION = 1,
+    };
+
+    struct Frame {
+	uint8_t type;
+	uint16_t length;
+	uint8_t payload[MAX_PAYLOAD];
+    };
+
+    /* SET_VIEW payload, 38 bytes
+     *     xmin, xmax, ymin, ymax (IEEE double, 8 each)
+     *     nmax (4)
+     *     engine (1), 0 = double precision escape time
+     *                 1, 2 = the same with pixels at the set boundary
+     *                        supersampled 4x / 16x
+     *     scale (1), display pixels per rendered pixel
+     */
+    enum {
+	VIEW_SIZE = 38,
+	ENGINE_DOUBLE = 0,
+	ENGINE_DOUBLE_AA4 = 1,
+	ENGINE_DOUBLE_AA16 = 2,
+    };
+
+    /* Wait for the next frame with a valid CRC. timeout_us = 0 waits
+     * forever, sync0 tells that the caller already consumed SYNC0.
+     */
+    Error receive(Frame &frame, uint32_t timeout_us = 0, bool sync0 = false);
+
+    /* Send a frame, the payload is the concatenation of both parts.
+     * Threads take turns, a frame is never mixed with another one.
+     */
+    void send(uint8_t type, const void *head, uint16_t head_len,
+	      const void *data = 0, uint16_t data_len = 0);
+
+    void ack(uint8_t type, Error error);
+    void pong(void);
+
+    /* Answer a SET_BAUD frame and switch, fall back to the old rate if
+     * the host doesn't talk to us at the new one.
+     */
+    Error negotiate_baud(const Frame &frame);
+
+    // little endian fields, the payload has no alignment
+    static inline uint16_t get16(const uint8_t *p) {
+	return p[0] | p[1] << 8;
+    }
+
+    static inline uint32_t get32(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    static inline double get_double(const uint8_t *p) {
+	double x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+    }
+
+    static inline void put16(uint8_t *p, uint16_t x) {
+	p[0] = x;
+	p[1] = x >> 8;
+    }
+
+    static inline void put32(uint8_t *p, uint32_t x) {
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+    }
+}
+
+#endif // #ifndef KERNEL_REMOTE_H
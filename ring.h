@@ -0,0 +1,68 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Lock-free single producer single consumer ring buffer
+ *
+ * One side only writes head, the other only writes tail, so no
+ * exclusive access is needed. SIZE must be a power of 2. A zeroed
+ * Ring is empty, so they can live in the BSS.
+ */
+
+#ifndef KERNEL_RING_H
+#define KERNEL_RING_H 1
+
+#include <stdint.h>
+#include "sync.h"
+
+template<typename T, uint32_t SIZE>
+struct Ring {
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+    Sync::Atomic<uint32_t> head; // next slot to write, producer only
+    Sync::Atomic<uint32_t> tail; // next slot to read, consumer only
+    T data[SIZE];
+
+    bool empty(void) const {
+	return head.load() == tail.load();
+    }
+
+    // slots the producer may still fill
+    uint32_t space(void) const {
+	return SIZE - (head.load(Sync::RELAXED) - tail.load());
+    }
+
+    // producer
+    bool push(const T &x) {
+	uint32_t h = head.load(Sync::RELAXED);
+	if (h - tail.load() == SIZE) return false;
+	data[h % SIZE] = x;
+	head.store(h + 1);
+	return true;
+    }
+
+    // consumer
+    bool pop(T &x) {
+	uint32_t t = tail.load(Sync::RELAXED);
+	if (t == head.load()) return false;
+	x = data[t % SIZE];
+	tail.store(t + 1);
+	return true;
+    }
+};
+
+#endif // #ifndef KERNEL_RING_H
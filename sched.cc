@@ -0,0 +1,409 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Preemptive thread scheduler for the Raspberry Pi 2
+ *
+ * Locks are always taken with interrupts disabled and at most one run
+ * queue lock is held at a time. A thread may sit in a run queue while
+ * its old core is still switching away from it, on_cpu tells the next
+ * core to wait for that.
+ */
+
+#include <stdint.h>
+#include "sched.h"
+#include "memory.h"
+#include "heap.h"
+#include "time.h"
+#include "ipi.h"
+#include "stdio.h"
+
+namespace Sched {
+    enum {
+	STACK_PAGES = 4,
+	SLICE_US = 10000,
+	// switch_context frame: fpscr, pad, d8-d15, r4-r11, ip, lr
+	FRAME_WORDS = 2 + 16 + 10,
+	FRAME_R4 = 2 + 16,
+	FRAME_R5 = FRAME_R4 + 1,
+	FRAME_LR = FRAME_WORDS - 1,
+    };
+}
+
+extern "C" {
+    void switch_context(uint32_t **save_sp, uint32_t *sp);
+    void thread_start(void);
+    void thread_entry(Sched::entry_t entry, void *arg);
+}
+
+namespace Sched {
+    struct RunQueue {
+	Sync::TicketLock lock;
+	Thread *head[NUM_PRIORITIES];
+	Thread *tail[NUM_PRIORITIES];
+	Thread *current;
+	Thread *idle;
+	// thread switched away from, for finish_switch()
+	Thread *prev;
+	volatile bool need_resched;
+    };
+
+    static RunQueue queues[SMP::NUM_CORES];
+    // cores running their idle thread
+    static Sync::Atomic<uint32_t> idle_cores;
+    static Sync::TicketLock all_lock;
+    static Thread *all_threads;
+
+    Thread * current(void) {
+	return queues[SMP::core_id()].current;
+    }
+
+    // run queue lock held
+    static void enqueue(RunQueue &rq, Thread *t) {
+	t->next = 0;
+	if (rq.tail[t->priority]) {
+	    rq.tail[t->priority]->next = t;
+	} else {
+	    rq.head[t->priority] = t;
+	}
+	rq.tail[t->priority] = t;
+    }
+
+    // run queue lock held, first thread allowed on core
+    static Thread * dequeue(RunQueue &rq, uint32_t core) {
+	for (uint32_t prio = 0; prio < NUM_PRIORITIES; ++prio) {
+	    Thread *prev = 0;
+	    for (Thread *t = rq.head[prio]; t; prev = t, t = t->next) {
+		if (!(t->affinity & (1U << core))) continue;
+		if (prev) {
+		    prev->next = t->next;
+		} else {
+		    rq.head[prio] = t->next;
+		}
+		if (rq.tail[prio] == t) rq.tail[prio] = prev;
+		t->next = 0;
+		return t;
+	    }
+	}
+	return 0;
+    }
+
+    // stay on the last core if allowed
+    static uint32_t pick_core(Thread *t) {
+	if (t->affinity & (1U << t->core)) return t->core;
+	return __builtin_ctz(t->affinity);
+    }
+
+    // interrupts disabled
+    static void make_runnable(Thread *t) {
+	uint32_t self = SMP::core_id();
+	uint32_t core = pick_core(t);
+	RunQueue &rq = queues[core];
+	rq.lock.lock();
+	t->state.store(RUNNABLE, Sync::RELAXED);
+	enqueue(rq, t);
+	bool kick = rq.current == rq.idle ||
+	    t->priority < rq.current->priority;
+	if (kick) rq.need_resched = true;
+	rq.lock.unlock();
+	if (kick) {
+	    if (core != self) IPI::post(core, IPI::WAKE, 0);
+	} else {
+	    // let an idle core steal it
+	    uint32_t idle = idle_cores.load(Sync::RELAXED) & t->affinity;
+	    if (idle) {
+		uint32_t other = __builtin_ctz(idle);
+		if (other != self) IPI::post(other, IPI::WAKE, 0);
+	    }
+	}
+    }
+
+    // take a queued thread from another core
+    static Thread * steal(uint32_t self) {
+	for (uint32_t i = 1; i < SMP::NUM_CORES; ++i) {
+	    RunQueue &rq = queues[(self + i) % SMP::NUM_CORES];
+	    if (!rq.lock.try_lock()) continue;
+	    Thread *t = dequeue(rq, self);
+	    rq.lock.unlock();
+	    if (t) return t;
+	}
+	return 0;
+    }
+
+    static void slice_expired(void *) {
+	queues[SMP::core_id()].need_resched = true;
+    }
+
+    static void free_thread(Thread *t) {
+	all_lock.lock();
+	for (Thread **p = &all_threads; *p; p = &(*p)->all_next) {
+	    if (*p == t) {
+		*p = t->all_next;
+		break;
+	    }
+	}
+	all_lock.unlock();
+	if (t->stack) Memory::free_pages(t->stack, STACK_PAGES);
+	Heap::free(t);
+    }
+
+    // first thing after switch_context returns, on the new thread
+    static void finish_switch(void) {
+	Thread *prev = queues[SMP::core_id()].prev;
+	if (prev->state.load(Sync::RELAXED) == DEAD) {
+	    free_thread(prev);
+	} else {
+	    prev->on_cpu.store(0, Sync::RELEASE);
+	}
+    }
+
+    // interrupts disabled
+    static void schedule(void) {
+	uint32_t self = SMP::core_id();
+	RunQueue &rq = queues[self];
+	Thread *prev = rq.current;
+	rq.need_resched = false;
+	// prev goes back into a queue unless it blocks or exits
+	if (prev != rq.idle && prev->state.load(Sync::RELAXED) == RUNNING) {
+	    if (pick_core(prev) == self) {
+		// no need to wake anyone, we pick next
+		rq.lock.lock();
+		prev->state.store(RUNNABLE, Sync::RELAXED);
+		enqueue(rq, prev);
+		rq.lock.unlock();
+	    } else {
+		make_runnable(prev);
+	    }
+	}
+	rq.lock.lock();
+	Thread *next = dequeue(rq, self);
+	rq.lock.unlock();
+	if (!next) next = steal(self);
+	if (!next) next = rq.idle;
+
+	next->state.store(RUNNING, Sync::RELAXED);
+	if (next == rq.idle) {
+	    idle_cores.fetch_or(1U << self, Sync::RELAXED);
+	    Time::cancel_alarm();
+	} else {
+	    idle_cores.fetch_and(~(1U << self), Sync::RELAXED);
+	    Time::set_alarm(Time::ticks() + Time::ns_to_ticks(SLICE_US * 1000ULL),
+			    slice_expired, 0);
+	}
+	if (next == prev) return;
+
+	// its old core may still be saving it
+	while (next->on_cpu.load(Sync::ACQUIRE)) { }
+	next->on_cpu.store(1, Sync::RELAXED);
+	next->core = self;
+	++next->switches;
+	uint64_t now = Time::ticks();
+	prev->runtime += now - prev->last_start;
+	next->last_start = now;
+	rq.current = next;
+	rq.prev = prev;
+	switch_context(&prev->sp, next->sp);
+	finish_switch();
+    }
+
+    static Thread * new_thread(const char *name, entry_t entry, void *arg,
+			       Priority priority, uint32_t affinity) {
+	Thread *t = (Thread *)Heap::alloc(sizeof(Thread));
+	if (!t) return 0;
+	void *stack = Memory::alloc_pages(STACK_PAGES);
+	if (!stack) {
+	    Heap::free(t);
+	    return 0;
+	}
+	uint32_t *sp = (uint32_t *)((char *)stack + STACK_PAGES * Memory::PAGE_SIZE) - FRAME_WORDS;
+	for (uint32_t i = 0; i < FRAME_WORDS; ++i) sp[i] = 0;
+	// start with the creator's rounding and flush-to-zero modes
+	asm volatile ("vmrs %0, fpscr" : "=r" (sp[0]));
+	sp[FRAME_R4] = (uint32_t)entry;
+	sp[FRAME_R5] = (uint32_t)arg;
+	sp[FRAME_LR] = (uint32_t)thread_start;
+
+	t->sp = sp;
+	t->next = 0;
+	t->name = name;
+	t->stack = stack;
+	t->priority = priority;
+	t->state.store(BLOCKED, Sync::RELAXED);
+	t->on_cpu.store(0, Sync::RELAXED);
+	t->core = SMP::core_id();
+	t->affinity = affinity & ALL_CORES;
+	t->switches = 0;
+	t->runtime = 0;
+	t->last_start = 0;
+	uint32_t flags = IRQ::save_disable();
+	all_lock.lock();
+	t->all_next = all_threads;
+	all_threads = t;
+	all_lock.unlock();
+	IRQ::restore(flags);
+	return t;
+    }
+
+    static void idle_loop(void *) {
+	while(true) {
+	    uint32_t flags = IRQ::save_disable();
+	    schedule();
+	    // nothing to run, sleep until an interrupt
+	    if (current() == queues[SMP::core_id()].idle) IRQ::wait();
+	    IRQ::restore(flags);
+	}
+    }
+
+    void init_core(const char *name) {
+	uint32_t core = SMP::core_id();
+	RunQueue &rq = queues[core];
+	Thread *t = (Thread *)Heap::alloc(sizeof(Thread));
+	t->sp = 0;
+	t->next = 0;
+	t->name = name;
+	t->stack = 0;
+	t->priority = NORMAL;
+	t->state.store(RUNNING, Sync::RELAXED);
+	t->on_cpu.store(1, Sync::RELAXED);
+	t->core = core;
+	// the boot code expects to stay where it is
+	t->affinity = 1U << core;
+	t->switches = 0;
+	t->runtime = 0;
+	t->last_start = Time::ticks();
+	uint32_t flags = IRQ::save_disable();
+	all_lock.lock();
+	t->all_next = all_threads;
+	all_threads = t;
+	all_lock.unlock();
+	rq.idle = new_thread("idle", idle_loop, 0, LOW, 1U << core);
+	rq.current = t;
+	Time::set_alarm(Time::ticks() + Time::ns_to_ticks(SLICE_US * 1000ULL),
+			slice_expired, 0);
+	IRQ::restore(flags);
+    }
+
+    Thread * create(const char *name, entry_t entry, void *arg,
+		    Priority priority, uint32_t affinity) {
+	Thread *t = new_thread(name, entry, arg, priority, affinity);
+	if (!t) return 0;
+	uint32_t flags = IRQ::save_disable();
+	make_runnable(t);
+	if (queues[SMP::core_id()].need_resched) schedule();
+	IRQ::restore(flags);
+	return t;
+    }
+
+    void yield(void) {
+	uint32_t flags = IRQ::save_disable();
+	schedule();
+	IRQ::restore(flags);
+    }
+
+    void exit(void) {
+	IRQ::disable_interrupts();
+	current()->state.store(DEAD, Sync::RELAXED);
+	schedule();
+	// not reached
+	while(true) { }
+    }
+
+    void set_affinity(uint32_t mask) {
+	mask &= ALL_CORES;
+	if (!mask) return;
+	current()->affinity = mask;
+	if (!(mask & (1U << SMP::core_id()))) yield();
+    }
+
+    void set_priority(Priority priority) {
+	current()->priority = priority;
+	yield();
+    }
+
+    void preempt(void) {
+	RunQueue &rq = queues[SMP::core_id()];
+	if (rq.current && rq.need_resched) schedule();
+    }
+
+    void WaitQueue::sleep_locked(void) {
+	Thread *self = current();
+	self->next = 0;
+	if (tail) {
+	    tail->next = self;
+	} else {
+	    head = self;
+	}
+	tail = self;
+	self->state.store(BLOCKED, Sync::RELAXED);
+	lock.unlock();
+	schedule();
+	lock.lock();
+    }
+
+    void WaitQueue::wake_one(void) {
+	uint32_t flags = IRQ::save_disable();
+	lock.lock();
+	Thread *t = head;
+	if (t) {
+	    head = t->next;
+	    if (!head) tail = 0;
+	}
+	lock.unlock();
+	if (t) make_runnable(t);
+	if (!IRQ::in_handler()) preempt();
+	IRQ::restore(flags);
+    }
+
+    void WaitQueue::wake_all(void) {
+	uint32_t flags = IRQ::save_disable();
+	lock.lock();
+	Thread *t = head;
+	head = tail = 0;
+	lock.unlock();
+	while (t) {
+	    // t may wait again as soon as it is runnable
+	    Thread *next = t->next;
+	    make_runnable(t);
+	    t = next;
+	}
+	if (!IRQ::in_handler()) preempt();
+	IRQ::restore(flags);
+    }
+
+    void dump(void) {
+	static const char *states[] = {
+	    "running ", "runnable", "blocked ", "dead    ",
+	};
+	puts("thread      core prio state    switches  runtime [us]\n");
+	uint32_t flags = IRQ::save_disable();
+	all_lock.lock();
+	for (Thread *t = all_threads; t; t = t->all_next) {
+	    printf("%-12s%4lu%5u %s%9lu%15llu\n", t->name, t->core, t->priority,
+		   states[t->state.load(Sync::RELAXED)], t->switches,
+		   Time::ticks_to_ns(t->runtime) / 1000);
+	}
+	all_lock.unlock();
+	IRQ::restore(flags);
+    }
+}
+
+void thread_entry(Sched::entry_t entry, void *arg) {
+    Sched::finish_switch();
+    IRQ::enable_interrupts();
+    entry(arg);
+    Sched::exit();
+}
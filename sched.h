@@ -0,0 +1,125 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Preemptive thread scheduler for the Raspberry Pi 2
+ *
+ * Every core has a run queue per priority. A thread that uses up its
+ * time slice goes to the back of its queue, an idle core steals
+ * threads from the other queues. Threads run in SVC mode, interrupts
+ * are taken on the interrupted thread's stack.
+ */
+
+#ifndef KERNEL_SCHED_H
+#define KERNEL_SCHED_H 1
+
+#include <stdint.h>
+#include "sync.h"
+#include "irq.h"
+#include "smp.h"
+
+namespace Sched {
+    enum Priority {
+	HIGH,
+	NORMAL,
+	LOW,
+	NUM_PRIORITIES
+    };
+
+    enum State {
+	RUNNING,
+	RUNNABLE,
+	BLOCKED,
+	DEAD,
+    };
+
+    enum {
+	ALL_CORES = (1 << SMP::NUM_CORES) - 1,
+    };
+
+    typedef void (*entry_t)(void *arg);
+
+    struct Thread {
+	uint32_t *sp;		// saved by switch_context, must be first
+	Thread *next;		// run queue or wait queue
+	Thread *all_next;	// all threads, for dump()
+	const char *name;
+	void *stack;		// 0 for the threads started by the boot code
+	Priority priority;
+	Sync::Atomic<uint32_t> state;
+	// set until the core running it has switched away
+	Sync::Atomic<uint32_t> on_cpu;
+	uint32_t core;		// core it runs or last ran on
+	uint32_t affinity;	// mask of cores it may run on
+	uint32_t switches;
+	uint64_t runtime;	// Time::ticks()
+	uint64_t last_start;
+    };
+
+    // every core, once: turn the calling code into a thread pinned to
+    // this core and start the core's idle thread. Needs Time::init_core()
+    void init_core(const char *name);
+
+    // returns 0 when out of memory
+    Thread * create(const char *name, entry_t entry, void *arg,
+		    Priority priority = NORMAL,
+		    uint32_t affinity = ALL_CORES);
+
+    // 0 before init_core()
+    Thread * current(void);
+
+    void yield(void);
+    void exit(void) __attribute__((noreturn));
+    // moves the calling thread to an allowed core if needed
+    void set_affinity(uint32_t mask);
+    void set_priority(Priority priority);
+
+    // switches if the slice ran out or a more important thread got
+    // woken, called by irq_handler() last, interrupts disabled
+    void preempt(void);
+
+    // threads sleeping on a condition
+    struct WaitQueue {
+	Sync::TicketLock lock;
+	Thread *head;
+	Thread *tail;
+
+	// pred() is checked with the lock held, wake_*() take the lock, so
+	// setting the condition and then waking can't be missed
+	template<typename Pred>
+	void wait_until(Pred pred) {
+	    uint32_t flags = IRQ::save_disable();
+	    lock.lock();
+	    while (!pred()) {
+		sleep_locked();
+	    }
+	    lock.unlock();
+	    IRQ::restore(flags);
+	}
+
+	void wake_one(void);
+	void wake_all(void);
+
+	// unlocks, sleeps until woken and relocks
+	void sleep_locked(void);
+    };
+
+    // print all threads
+    void dump(void);
+}
+
+#endif // #ifndef KERNEL_SCHED_H
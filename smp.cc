@@ -24,6 +24,13 @@
 #include "stdio.h"
 #include "mmu.h"
 #include "fpu.h"
+#include "irq.h"
+#include "ipi.h"
+#include "time.h"
+#include "sched.h"
+#include "cache.h"
+#include "barriers.h"
+#include "sync.h"
 
 namespace SMP {
     // Setup SMP (Boot Offset = $4000008C + ($10 * Core), Core = 1..3)
@@ -49,44 +56,76 @@ namespace SMP {
 	return mpidr;
     }
 
+    uint32_t core_id(void) {
+	return get_mpidr() & 3;
+    }
+
     extern "C" {
 	void core_wakeup(void);
 	void core_main(void);
     }
 
-    static start_fn_t start_fn;
-    void *start_arg;
-    volatile bool started;
+    // what each core runs once it is initialized
+    struct Start {
+	start_fn_t fn;
+	void *arg;
+    };
+
+    static Start slots[NUM_CORES];
+    // number of cores through MMU and FPU init
+    static Sync::Atomic<uint32_t> arrived;
 
     void core_main(void) {
-	puts("core is up: MPIDR = ");
-	put_uint32(get_mpidr());
-	putc('\n');
+	uint32_t core = core_id();
+	// MMU and caches are still off, the slot was cleaned to memory
+	Start start = slots[core];
 	MMU::init();
-	puts("core is virtual\n");
 	FPU::init();
-	puts("core is floating\n");
-	
-	start_fn_t temp_fn = start_fn;
-	void *temp_arg = start_arg;
-	started = true;
-	temp_fn(temp_arg);
+	IRQ::init_core();
+	Time::init_core();
+	IPI::init_core();
+	static const char *names[NUM_CORES] = {
+	    "main", "core 1", "core 2", "core 3",
+	};
+	Sched::init_core(names[core]);
+	arrived.fetch_add(1, Sync::RELEASE);
+	start.fn(start.arg);
 	// FIXME: make restartable?
 	while(true) { }
     }
 
+    // wake up the cores in mask, caller waits for them
+    static void release(uint32_t mask) {
+	// secondaries read the slots with caches off
+	Cache::clean_range(slots, sizeof(slots));
+	Cache::clean_range(&arrived, sizeof(arrived));
+	for (uint32_t core = 1; core < NUM_CORES; ++core) {
+	    if (mask & (1U << core)) *mailbox(core) = core_wakeup;
+	}
+	data_sync_barrier();
+	// the firmware parks the cores in WFE
+	asm volatile ("sev");
+    }
+
+    void start_cores(start_fn_t start, void * const args[NUM_CORES]) {
+	arrived.store(0, Sync::RELAXED);
+	for (uint32_t core = 1; core < NUM_CORES; ++core) {
+	    slots[core].fn = start;
+	    slots[core].arg = args[core];
+	}
+	release(~1U);
+	while(arrived.load(Sync::ACQUIRE) < NUM_CORES - 1) { }
+	puts("started cores 1-3\n");
+    }
+
     void start_core(int core, start_fn_t start, void *arg) {
-	start_fn = start;
-	start_arg = arg;
-	puts("starting core ");
-	putc("0123"[core]);
-	putc('\n');
-	started = false;
-	*mailbox(core) = core_wakeup;
-	while(!started) { }
+	arrived.store(0, Sync::RELAXED);
+	slots[core].fn = start;
+	slots[core].arg = arg;
+	release(1U << core);
+	while(arrived.load(Sync::ACQUIRE) < 1) { }
 	puts("started core ");
 	putc("0123"[core]);
 	putc('\n');
     }
 }
-
@@ -22,9 +22,21 @@
 #ifndef KERNEL_SMP_H
 #define KERNEL_SMP_H 1
 
+#include <stdint.h>
+
 namespace SMP {
+    enum {
+	NUM_CORES = 4,
+    };
+
+    // number of the core running this code
+    uint32_t core_id(void);
+
     typedef void (*start_fn_t)(void *);
-    // wake up the additional cores
+    // wake up cores 1-3 at once, core n runs start(args[n]) after its
+    // MMU and FPU init, returns when all of them got that far
+    void start_cores(start_fn_t start, void * const args[NUM_CORES]);
+    // wake up a single additional core
     void start_core(int core, start_fn_t start, void *arg);
 }
 
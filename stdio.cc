@@ -41,3 +41,261 @@ void put_uint32(uint32_t x) {
     }
     UART::write(buf, 10);
 }
+
+void put_dec(uint32_t x, uint32_t width) {
+    char buf[32];
+    uint32_t i = sizeof(buf);
+    do {
+	buf[--i] = '0' + x % 10;
+	x /= 10;
+    } while (x > 0);
+    while (i > 0 && sizeof(buf) - i < width) buf[--i] = ' ';
+    UART::write(&buf[i], sizeof(buf) - i);
+}
+
+namespace {
+    // counts everything, stores what fits
+    struct Output {
+	char *buf;
+	size_t size;
+	size_t pos;
+
+	void put(char c) {
+	    if (pos + 1 < size) buf[pos] = c;
+	    ++pos;
+	}
+
+	void pad(char c, int count) {
+	    while (count-- > 0) put(c);
+	}
+    };
+
+    enum {
+	LEFT  = 1 << 0,
+	ZERO  = 1 << 1,
+	PLUS  = 1 << 2,
+	SPACE = 1 << 3,
+    };
+
+    // digits (reversed) with sign and padding
+    void format(Output &out, const char *digits, int len, char sign,
+		int width, uint32_t flags) {
+	int fill = width - len - (sign ? 1 : 0);
+	if (!(flags & (LEFT | ZERO))) out.pad(' ', fill);
+	if (sign) out.put(sign);
+	if (flags & ZERO && !(flags & LEFT)) out.pad('0', fill);
+	while (len > 0) out.put(digits[--len]);
+	if (flags & LEFT) out.pad(' ', fill);
+    }
+
+    int to_digits(char *digits, uint64_t x, uint32_t base, bool upper,
+		  int min_digits) {
+	const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	int len = 0;
+	// 32 bit division is a lot cheaper
+	while (x > 0xFFFFFFFFULL) {
+	    digits[len++] = hex[x % base];
+	    x /= base;
+	}
+	uint32_t y = x;
+	do {
+	    digits[len++] = hex[y % base];
+	    y /= base;
+	} while (y > 0);
+	while (len < min_digits) digits[len++] = '0';
+	return len;
+    }
+
+    char sign_char(bool negative, uint32_t flags) {
+	if (negative) return '-';
+	if (flags & PLUS) return '+';
+	if (flags & SPACE) return ' ';
+	return 0;
+    }
+
+    void format_double(Output &out, double x, int width, int precision,
+		       uint32_t flags) {
+	static const uint32_t scales[] = {
+	    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+	    100000000, 1000000000,
+	};
+	char digits[32];
+	bool negative = x < 0;
+	if (negative) x = -x;
+	if (__builtin_isnan(x) || __builtin_isinf(x)) {
+	    const char *text = __builtin_isnan(x) ? "nan" : "inf";
+	    for (int i = 0; i < 3; ++i) digits[i] = text[2 - i];
+	    format(out, digits, 3, sign_char(negative, flags), width,
+		   flags & ~ZERO);
+	    return;
+	}
+	// too big for the integer part, print d.ddd with an exponent
+	uint32_t exp10 = 0;
+	if (x >= 1.8e19) {
+	    while (x >= 1e16) {
+		x /= 1e16;
+		exp10 += 16;
+	    }
+	    while (x >= 10) {
+		x /= 10;
+		++exp10;
+	    }
+	}
+	if (precision < 0) precision = 6;
+	if (precision > 9) precision = 9;
+	uint64_t whole = x;
+	uint32_t frac = (x - whole) * scales[precision] + 0.5;
+	if (frac >= scales[precision]) {
+	    ++whole;
+	    frac -= scales[precision];
+	}
+	if (exp10 && whole >= 10) {
+	    // rounded up to 10.000
+	    whole = 1;
+	    ++exp10;
+	}
+	int len = 0;
+	if (exp10) {
+	    len = to_digits(digits, exp10, 10, false, 2);
+	    digits[len++] = '+';
+	    digits[len++] = 'e';
+	}
+	if (precision > 0) {
+	    len += to_digits(digits + len, frac, 10, false, precision);
+	    digits[len++] = '.';
+	}
+	len += to_digits(digits + len, whole, 10, false, 1);
+	format(out, digits, len, sign_char(negative, flags), width, flags);
+    }
+}
+
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list ap) {
+    Output out = {buf, size, 0};
+    while (*fmt) {
+	char c = *fmt++;
+	if (c != '%') {
+	    out.put(c);
+	    continue;
+	}
+	uint32_t flags = 0;
+	while (true) {
+	    if (*fmt == '-') flags |= LEFT;
+	    else if (*fmt == '0') flags |= ZERO;
+	    else if (*fmt == '+') flags |= PLUS;
+	    else if (*fmt == ' ') flags |= SPACE;
+	    else break;
+	    ++fmt;
+	}
+	int width = 0;
+	if (*fmt == '*') {
+	    width = va_arg(ap, int);
+	    if (width < 0) {
+		flags |= LEFT;
+		width = -width;
+	    }
+	    ++fmt;
+	} else {
+	    while (*fmt >= '0' && *fmt <= '9') width = width * 10 + *fmt++ - '0';
+	}
+	int precision = -1;
+	if (*fmt == '.') {
+	    ++fmt;
+	    precision = 0;
+	    if (*fmt == '*') {
+		precision = va_arg(ap, int);
+		++fmt;
+	    } else {
+		while (*fmt >= '0' && *fmt <= '9') {
+		    precision = precision * 10 + *fmt++ - '0';
+		}
+	    }
+	}
+	bool wide = false;
+	if (*fmt == 'l') {
+	    ++fmt;
+	    if (*fmt == 'l') {
+		wide = true;
+		++fmt;
+	    }
+	} else if (*fmt == 'z') {
+	    ++fmt;
+	}
+	char digits[32];
+	int len;
+	switch (c = *fmt++) {
+	case 'd':
+	case 'i': {
+	    int64_t x = wide ? va_arg(ap, int64_t) : va_arg(ap, int32_t);
+	    uint64_t mag = x < 0 ? -(uint64_t)x : x;
+	    len = to_digits(digits, mag, 10, false, precision);
+	    format(out, digits, len, sign_char(x < 0, flags), width, flags);
+	    break;
+	}
+	case 'u':
+	case 'x':
+	case 'X': {
+	    uint64_t x = wide ? va_arg(ap, uint64_t) : va_arg(ap, uint32_t);
+	    len = to_digits(digits, x, c == 'u' ? 10 : 16, c == 'X', precision);
+	    format(out, digits, len, 0, width, flags);
+	    break;
+	}
+	case 'p':
+	    len = to_digits(digits, (uintptr_t)va_arg(ap, void *), 16, true, 8);
+	    digits[len++] = 'x';
+	    digits[len++] = '0';
+	    format(out, digits, len, 0, width, flags & ~ZERO);
+	    break;
+	case 'c':
+	    digits[0] = va_arg(ap, int);
+	    format(out, digits, 1, 0, width, flags & ~ZERO);
+	    break;
+	case 's': {
+	    const char *str = va_arg(ap, const char *);
+	    if (!str) str = "(null)";
+	    int n = strlen(str);
+	    if (precision >= 0 && n > precision) n = precision;
+	    int fill = width - n;
+	    if (!(flags & LEFT)) out.pad(' ', fill);
+	    for (int i = 0; i < n; ++i) out.put(str[i]);
+	    if (flags & LEFT) out.pad(' ', fill);
+	    break;
+	}
+	case 'f':
+	    format_double(out, va_arg(ap, double), width, precision, flags);
+	    break;
+	case '%':
+	    out.put('%');
+	    break;
+	default:
+	    // unknown conversion, show it
+	    out.put('%');
+	    if (c) {
+		out.put(c);
+	    } else {
+		--fmt;
+	    }
+	}
+    }
+    if (size > 0) buf[out.pos < size ? out.pos : size - 1] = 0;
+    return out.pos;
+}
+
+int snprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int res = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return res;
+}
+
+int printf(const char *fmt, ...) {
+    // private to this call, interrupt handlers and other threads
+    // printing on this core use their own
+    char buf[PRINTF_BUFFER];
+    va_list ap;
+    va_start(ap, fmt);
+    int res = vsnprintf(buf, PRINTF_BUFFER, fmt, ap);
+    va_end(ap);
+    UART::write(buf, res < PRINTF_BUFFER ? res : PRINTF_BUFFER - 1);
+    return res;
+}
@@ -23,6 +23,8 @@
 #define _STDIO_H 1
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +33,20 @@ extern "C" {
 void putc(char c);
 void puts(const char *str);
 void put_uint32(uint32_t x);
+// decimal, padded with spaces to at least width characters
+void put_dec(uint32_t x, uint32_t width);
+
+// %d %i %u %x %X %p %c %s %f %%, flags '-' '0' '+' ' ', width and
+// precision (also as '*'), length 'l', 'll', 'z'. %f is fixed point
+// with at most 9 digits after the point, from 1.8e19 on it gets an
+// exponent like %e.
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
+int snprintf(char *buf, size_t size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+// formats into a stack buffer and writes it in one go, at most
+// PRINTF_BUFFER - 1 characters
+enum { PRINTF_BUFFER = 256 };
+int printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 
 #ifdef __cplusplus
 }
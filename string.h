@@ -29,6 +29,9 @@ extern "C" {
 #endif
 
 void * memcpy(void * __restrict__ dest, const void * __restrict__ src, size_t n) __attribute__((used));
+void * memmove(void *dest, const void *src, size_t n) __attribute__((used));
+void * memset(void *dest, int c, size_t n) __attribute__((used));
+int memcmp(const void *s1, const void *s2, size_t n);
 
 size_t strlen(const char *str);
     
@@ -0,0 +1,225 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Locks and atomics for the Raspberry Pi 2
+ *
+ * All types are plain structs that are unlocked / zero when zero
+ * initialized, so they work as globals without constructors.
+ * Waiting cores sleep in WFE, every unlock wakes them with SEV.
+ */
+
+#ifndef KERNEL_SYNC_H
+#define KERNEL_SYNC_H 1
+
+#include <stdint.h>
+
+namespace Sync {
+    // memory order, on ARMv7 ACQUIRE and RELEASE cost one DMB each
+    enum Order {
+	RELAXED = __ATOMIC_RELAXED,
+	ACQUIRE = __ATOMIC_ACQUIRE,
+	RELEASE = __ATOMIC_RELEASE,
+	ACQ_REL = __ATOMIC_ACQ_REL,
+	SEQ_CST = __ATOMIC_SEQ_CST,
+    };
+
+    static inline void wait_event(void) {
+	asm volatile ("wfe" ::: "memory");
+    }
+
+    // make the unlocking store visible, then wake the waiters
+    static inline void send_event(void) {
+	asm volatile ("dsb\n\tsev" ::: "memory");
+    }
+
+    // load-acquire / store-release / read-modify-write on a word
+    template<typename T>
+    struct Atomic {
+	T value;
+
+	T load(Order order = ACQUIRE) const {
+	    return __atomic_load_n(&value, order);
+	}
+
+	void store(T x, Order order = RELEASE) {
+	    __atomic_store_n(&value, x, order);
+	}
+
+	T exchange(T x, Order order = ACQ_REL) {
+	    return __atomic_exchange_n(&value, x, order);
+	}
+
+	// on failure expected is updated to the current value
+	bool compare_exchange(T &expected, T x, Order order = ACQ_REL) {
+	    Order fail = (order == ACQ_REL) ? ACQUIRE
+		: (order == RELEASE) ? RELAXED : order;
+	    return __atomic_compare_exchange_n(&value, &expected, x, false,
+					       order, fail);
+	}
+
+	T fetch_add(T x, Order order = ACQ_REL) {
+	    return __atomic_fetch_add(&value, x, order);
+	}
+
+	T fetch_sub(T x, Order order = ACQ_REL) {
+	    return __atomic_fetch_sub(&value, x, order);
+	}
+
+	T fetch_and(T x, Order order = ACQ_REL) {
+	    return __atomic_fetch_and(&value, x, order);
+	}
+
+	T fetch_or(T x, Order order = ACQ_REL) {
+	    return __atomic_fetch_or(&value, x, order);
+	}
+    };
+
+    // fair: cores get the lock in the order they asked for it
+    struct TicketLock {
+	Atomic<uint32_t> next;
+	Atomic<uint32_t> owner;
+
+	void lock(void) {
+	    uint32_t ticket = next.fetch_add(1, RELAXED);
+	    while (owner.load(ACQUIRE) != ticket) wait_event();
+	}
+
+	bool try_lock(void) {
+	    uint32_t ticket = owner.load(RELAXED);
+	    return next.compare_exchange(ticket, ticket + 1, ACQUIRE);
+	}
+
+	void unlock(void) {
+	    owner.store(owner.load(RELAXED) + 1, RELEASE);
+	    send_event();
+	}
+    };
+
+    // one per waiting core, lives on the waiter's stack
+    struct MCSNode {
+	Atomic<MCSNode *> next;
+	Atomic<uint32_t> locked;
+    };
+
+    // fair, and each waiter spins on its own node's cache line
+    struct MCSLock {
+	Atomic<MCSNode *> tail;
+
+	void lock(MCSNode &node) {
+	    node.next.store(0, RELAXED);
+	    node.locked.store(1, RELAXED);
+	    MCSNode *prev = tail.exchange(&node, ACQ_REL);
+	    if (prev == 0) return;
+	    prev->next.store(&node, RELEASE);
+	    while (node.locked.load(ACQUIRE)) wait_event();
+	}
+
+	void unlock(MCSNode &node) {
+	    MCSNode *succ = node.next.load(ACQUIRE);
+	    if (succ == 0) {
+		MCSNode *self = &node;
+		if (tail.compare_exchange(self, 0, RELEASE)) return;
+		// a successor is between exchange and linking itself in
+		while ((succ = node.next.load(ACQUIRE)) == 0) { }
+	    }
+	    succ->locked.store(0, RELEASE);
+	    send_event();
+	}
+    };
+
+    // many readers or one writer, a waiting writer blocks new readers
+    struct RWLock {
+	enum {
+	    WRITER  = 1U << 31,
+	    WAITING = 1U << 30,
+	    READERS = WAITING - 1,
+	};
+
+	Atomic<uint32_t> state;
+
+	void read_lock(void) {
+	    while (true) {
+		uint32_t s = state.load(RELAXED);
+		if ((s & (WRITER | WAITING)) == 0) {
+		    if (state.compare_exchange(s, s + 1, ACQUIRE)) return;
+		    continue;
+		}
+		wait_event();
+	    }
+	}
+
+	void read_unlock(void) {
+	    if ((state.fetch_sub(1, RELEASE) & READERS) == 1) send_event();
+	}
+
+	void write_lock(void) {
+	    while (true) {
+		uint32_t s = state.load(RELAXED);
+		if ((s & ~WAITING) == 0) {
+		    if (state.compare_exchange(s, WRITER, ACQUIRE)) return;
+		    continue;
+		}
+		if ((s & WAITING) == 0) {
+		    state.fetch_or(WAITING, RELAXED);
+		    continue;
+		}
+		wait_event();
+	    }
+	}
+
+	// also clears WAITING, other waiting writers set it again
+	void write_unlock(void) {
+	    state.store(0, RELEASE);
+	    send_event();
+	}
+    };
+
+    // scoped lock for TicketLock
+    template<typename Lock>
+    class Guard {
+    public:
+	explicit Guard(Lock &lock) : lock_(lock) {
+	    lock_.lock();
+	}
+	~Guard() {
+	    lock_.unlock();
+	}
+    private:
+	Guard(const Guard &);
+	Guard & operator =(const Guard &);
+	Lock &lock_;
+    };
+
+    // scoped lock for MCSLock, carries the queue node
+    class MCSGuard {
+    public:
+	explicit MCSGuard(MCSLock &lock) : lock_(lock) {
+	    lock_.lock(node_);
+	}
+	~MCSGuard() {
+	    lock_.unlock(node_);
+	}
+    private:
+	MCSGuard(const MCSGuard &);
+	MCSGuard & operator =(const MCSGuard &);
+	MCSLock &lock_;
+	MCSNode node_;
+    };
+}
+
+#endif // #ifndef KERNEL_SYNC_H
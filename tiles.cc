@@ -0,0 +1,248 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Persistent store of rendered tiles on the SD card
+ *
+ * Layout of the partition:
+ *     block 0      superblock
+ *     block 1..    one tag per slot, 0 for empty
+ *     after that   slots of SLOT_BLOCKS: a header with key and CRC,
+ *                  then the pixels
+ * The tags are read once at init(). The header is checked on every
+ * load, so a stale tag or a torn write only costs a lookup.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tiles.h"
+#include "emmc.h"
+#include "blockcache.h"
+#include "memory.h"
+#include "crc.h"
+#include "string.h"
+#include "barriers.h"
+
+namespace Tiles {
+    enum {
+	BLOCK_SIZE = EMMC::BLOCK_SIZE,
+	MAGIC = 0x4C49544D, // "MTIL"
+	VERSION = 1,
+	DATA_BLOCKS = MAX_TILE_BYTES / BLOCK_SIZE,
+	SLOT_BLOCKS = 1 + DATA_BLOCKS,
+	TAGS_PER_BLOCK = BLOCK_SIZE / 4,
+	MAX_SLOTS = 65536,
+	// second hash for the slot number
+	SLOT_SEED = 0x9E3779B9,
+
+	// MBR
+	MBR_PARTITIONS = 0x1BE,
+	MBR_ENTRY_SIZE = 16,
+	MBR_SIGNATURE = 0x1FE,
+    };
+
+    static_assert(sizeof(Key) == 40, "Key must not have padding");
+
+    struct Super {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t slot_blocks;
+	uint32_t tile_size;
+	uint32_t crc; // of the fields above
+    };
+
+    struct SlotHeader {
+	uint32_t magic;
+	Key key;
+	uint32_t size;
+	uint32_t crc; // of the pixels
+    };
+
+    static uint32_t first_block; // of the partition
+    static uint32_t num_slots;
+    static uint32_t slot_start;
+    static uint32_t *tags; // whole pages, one block of tags per 512 bytes
+    static volatile bool ready;
+    static uint8_t buf[SLOT_BLOCKS * BLOCK_SIZE];
+
+    static uint32_t get32(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    static uint32_t table_blocks(uint32_t slots) {
+	return (slots + TAGS_PER_BLOCK - 1) / TAGS_PER_BLOCK;
+    }
+
+    static Error find_partition(uint32_t &start, uint32_t &size) {
+	if (BlockCache::read(0, 1, buf) != EMMC::SUCCESS) return FAIL_IO;
+	if (buf[MBR_SIGNATURE] != 0x55 || buf[MBR_SIGNATURE + 1] != 0xAA) {
+	    return FAIL_NO_PARTITION;
+	}
+	for (uint32_t i = 0; i < 4; ++i) {
+	    const uint8_t *entry = &buf[MBR_PARTITIONS + i * MBR_ENTRY_SIZE];
+	    if (entry[4] != PARTITION_TYPE) continue;
+	    start = get32(&entry[8]);
+	    size = get32(&entry[12]);
+	    return SUCCESS;
+	}
+	return FAIL_NO_PARTITION;
+    }
+
+    static uint32_t super_crc(const Super &super) {
+	return CRC::crc32(&super, offsetof(Super, crc));
+    }
+
+    // new store: empty tag table, superblock last
+    static Error format(void) {
+	memset(tags, 0, table_blocks(num_slots) * BLOCK_SIZE);
+	if (BlockCache::write(first_block + 1, table_blocks(num_slots), tags)
+	    != EMMC::SUCCESS) {
+	    return FAIL_IO;
+	}
+	Super super;
+	super.magic = MAGIC;
+	super.version = VERSION;
+	super.slots = num_slots;
+	super.slot_blocks = SLOT_BLOCKS;
+	super.tile_size = TILE_SIZE;
+	super.crc = super_crc(super);
+	memset(buf, 0, BLOCK_SIZE);
+	memcpy(buf, &super, sizeof(super));
+	if (BlockCache::write(first_block, 1, buf) != EMMC::SUCCESS) return FAIL_IO;
+	if (BlockCache::flush() != EMMC::SUCCESS) return FAIL_IO;
+	return SUCCESS;
+    }
+
+    Error init(void) {
+	if (EMMC::blocks() == 0) return FAIL_NO_CARD;
+	if (BlockCache::init() != EMMC::SUCCESS) return FAIL_NO_MEMORY;
+	uint32_t size;
+	Error err = find_partition(first_block, size);
+	if (err != SUCCESS) return err;
+	if (size <= 1) return FAIL_NO_PARTITION;
+	// every slot costs SLOT_BLOCKS and 4 bytes of tag table
+	uint64_t slots = (uint64_t)(size - 1) * TAGS_PER_BLOCK
+	    / (TAGS_PER_BLOCK * SLOT_BLOCKS + 1);
+	if (slots == 0) return FAIL_NO_PARTITION;
+	num_slots = slots > MAX_SLOTS ? (uint32_t)MAX_SLOTS : (uint32_t)slots;
+	slot_start = first_block + 1 + table_blocks(num_slots);
+
+	uint32_t pages = (table_blocks(num_slots) * BLOCK_SIZE + Memory::PAGE_SIZE - 1)
+	    / Memory::PAGE_SIZE;
+	tags = (uint32_t *)Memory::alloc_pages(pages);
+	if (tags == 0) return FAIL_NO_MEMORY;
+
+	if (BlockCache::read(first_block, 1, buf) != EMMC::SUCCESS) return FAIL_IO;
+	Super super;
+	memcpy(&super, buf, sizeof(super));
+	if (super.magic != MAGIC || super.version != VERSION
+	    || super.slots != num_slots || super.slot_blocks != SLOT_BLOCKS
+	    || super.tile_size != TILE_SIZE || super.crc != super_crc(super)) {
+	    err = format();
+	} else {
+	    // straight from the card, the cache would only be thrashed
+	    uint32_t blocks = table_blocks(num_slots);
+	    uint8_t *p = (uint8_t *)tags;
+	    for (uint32_t b = 0; b < blocks; b += EMMC::MAX_BLOCKS) {
+		uint32_t n = blocks - b < EMMC::MAX_BLOCKS ? blocks - b : (uint32_t)EMMC::MAX_BLOCKS;
+		if (EMMC::read(first_block + 1 + b, n, &p[b * BLOCK_SIZE])
+		    != EMMC::SUCCESS) {
+		    return FAIL_IO;
+		}
+	    }
+	}
+	if (err != SUCCESS) return err;
+	// tags before the flag
+	data_memory_barrier();
+	ready = true;
+	return SUCCESS;
+    }
+
+    bool available(void) {
+	return ready;
+    }
+
+    static uint32_t tag(const Key &key) {
+	uint32_t t = CRC::crc32(&key, sizeof(key));
+	return t ? t : 1;
+    }
+
+    static uint32_t slot(const Key &key) {
+	return CRC::crc32(&key, sizeof(key), SLOT_SEED) % num_slots;
+    }
+
+    bool contains(const Key &key) {
+	if (!ready) return false;
+	return tags[slot(key)] == tag(key);
+    }
+
+    static uint32_t data_blocks(uint32_t size) {
+	return (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+
+    Error load(const Key &key, void *pixels, uint32_t size) {
+	if (!ready) return FAIL_NOT_FOUND;
+	if (size > MAX_TILE_BYTES) return FAIL_SIZE;
+	uint32_t s = slot(key);
+	if (tags[s] != tag(key)) return FAIL_NOT_FOUND;
+	if (BlockCache::read(slot_start + s * SLOT_BLOCKS, 1 + data_blocks(size), buf)
+	    != EMMC::SUCCESS) {
+	    return FAIL_IO;
+	}
+	SlotHeader header;
+	memcpy(&header, buf, sizeof(header));
+	if (header.magic != MAGIC || header.size != size
+	    || memcmp(&header.key, &key, sizeof(key)) != 0) {
+	    return FAIL_NOT_FOUND;
+	}
+	const uint8_t *data = &buf[BLOCK_SIZE];
+	if (CRC::crc32(data, size) != header.crc) return FAIL_NOT_FOUND;
+	memcpy(pixels, data, size);
+	return SUCCESS;
+    }
+
+    Error save(const Key &key, const void *pixels, uint32_t size) {
+	if (!ready) return FAIL_NOT_FOUND;
+	if (size > MAX_TILE_BYTES) return FAIL_SIZE;
+	uint32_t s = slot(key);
+	SlotHeader header;
+	header.magic = MAGIC;
+	header.key = key;
+	header.size = size;
+	header.crc = CRC::crc32(pixels, size);
+	memset(buf, 0, BLOCK_SIZE);
+	memcpy(buf, &header, sizeof(header));
+	memcpy(&buf[BLOCK_SIZE], pixels, size);
+	if (BlockCache::write(slot_start + s * SLOT_BLOCKS, 1 + data_blocks(size), buf)
+	    != EMMC::SUCCESS) {
+	    return FAIL_IO;
+	}
+	tags[s] = tag(key);
+	uint32_t b = s / TAGS_PER_BLOCK;
+	if (BlockCache::write(first_block + 1 + b, 1, &tags[b * TAGS_PER_BLOCK])
+	    != EMMC::SUCCESS) {
+	    return FAIL_IO;
+	}
+	return SUCCESS;
+    }
+
+    Error flush(void) {
+	if (!ready) return SUCCESS;
+	return BlockCache::flush() == EMMC::SUCCESS ? SUCCESS : FAIL_IO;
+    }
+}
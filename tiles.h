@@ -0,0 +1,73 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Persistent store of rendered tiles on the SD card
+ *
+ * The store lives in an MBR partition of type 0xDA (non-filesystem
+ * data) and is formatted on first use. A tile is found by hashing its
+ * key to a slot, a tag per slot kept in memory saves reading the card
+ * for tiles that were never stored. A newer tile replaces whatever was
+ * in its slot.
+ */
+
+#ifndef KERNEL_TILES_H
+#define KERNEL_TILES_H 1
+
+#include <stdint.h>
+
+namespace Tiles {
+    enum {
+	TILE_SIZE = 32, // pixels per side
+	MAX_TILE_BYTES = TILE_SIZE * TILE_SIZE * 4,
+	PARTITION_TYPE = 0xDA,
+    };
+
+    enum Error {
+	SUCCESS = 0,
+	FAIL_NO_CARD,
+	FAIL_NO_PARTITION,
+	FAIL_NO_MEMORY,
+	FAIL_IO,
+	FAIL_NOT_FOUND,
+	FAIL_SIZE,
+    };
+
+    // 40 bytes without padding, compared bytewise
+    struct Key {
+	double x, y;   // top left pixel
+	double dx, dy; // pixel size
+	uint32_t nmax;
+	uint8_t engine;
+	uint8_t depth; // bits per pixel
+	uint16_t size; // pixels per side
+    };
+
+    // find the partition, read or format the store, needs EMMC::init()
+    Error init(void);
+    // init() succeeded
+    bool available(void);
+
+    // the tag matches, the tile is most likely stored
+    bool contains(const Key &key);
+    Error load(const Key &key, void *pixels, uint32_t size);
+    // goes to the card with the next flush() or when the cache needs room
+    Error save(const Key &key, const void *pixels, uint32_t size);
+    Error flush(void);
+}
+
+#endif // #ifndef KERNEL_TILES_H
@@ -0,0 +1,130 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Time keeping for the Raspberry Pi 2
+ */
+
+#include <stdint.h>
+#include "time.h"
+#include "peripherals.h"
+#include "irq.h"
+#include "smp.h"
+#include "barriers.h"
+
+namespace Time {
+    enum {
+	// BCM system timer
+	SYSTEM_TIMER_CLO = 0x3004,
+	SYSTEM_TIMER_CHI = 0x3008,
+
+	// CNTKCTL: event on a 0 -> 1 transition of counter bit EVNTI,
+	// bit 6 at 19.2MHz gives an event every 6.7us
+	CNTKCTL_EVNTEN = 1 << 2,
+	CNTKCTL_EVNTI_SHIFT = 4,
+	EVENT_BIT = 6,
+
+	// CNTP_CTL
+	CNTP_CTL_ENABLE = 1 << 0,
+	CNTP_CTL_IMASK  = 1 << 1,
+
+	NS_PER_SEC = 1000000000,
+    };
+
+    struct Alarm {
+	alarm_fn_t fn;
+	void *arg;
+    };
+
+    static Alarm alarms[SMP::NUM_CORES];
+
+    // split so the multiplication can't overflow
+    uint64_t ticks_to_ns(uint64_t t) {
+	uint32_t freq = frequency();
+	return t / freq * NS_PER_SEC + t % freq * NS_PER_SEC / freq;
+    }
+
+    uint64_t ns_to_ticks(uint64_t ns) {
+	uint32_t freq = frequency();
+	return ns / NS_PER_SEC * freq + (ns % NS_PER_SEC * freq + NS_PER_SEC - 1) / NS_PER_SEC;
+    }
+
+    uint64_t system_us(void) {
+	uint32_t hi, lo;
+	// CHI changed while reading CLO, read again
+	do {
+	    hi = *Peripherals::reg(SYSTEM_TIMER_CHI);
+	    lo = *Peripherals::reg(SYSTEM_TIMER_CLO);
+	} while (hi != *Peripherals::reg(SYSTEM_TIMER_CHI));
+	return (uint64_t)hi << 32 | lo;
+    }
+
+    void delay_ns(uint64_t ns) {
+	uint64_t end = ticks() + ns_to_ticks(ns);
+	uint32_t cntkctl;
+	asm volatile ("mrc p15, 0, %0, c14, c1, 0" : "=r" (cntkctl));
+	if (cntkctl & CNTKCTL_EVNTEN) {
+	    // the last event may be up to 2 periods before the end
+	    uint64_t sleep_until = end - (2ULL << EVENT_BIT);
+	    while (ticks() < sleep_until) {
+		asm volatile ("wfe");
+	    }
+	}
+	while (ticks() < end) { }
+    }
+
+    static void handle_alarm(uint32_t, void *) {
+	asm volatile ("mcr p15, 0, %0, c14, c2, 1" :: "r" (0));
+	Alarm &alarm = alarms[SMP::core_id()];
+	alarm_fn_t fn = alarm.fn;
+	alarm.fn = 0;
+	if (fn) fn(alarm.arg);
+    }
+
+    void set_alarm(uint64_t deadline, alarm_fn_t fn, void *arg) {
+	uint32_t flags = IRQ::save_disable();
+	Alarm &alarm = alarms[SMP::core_id()];
+	alarm.fn = fn;
+	alarm.arg = arg;
+	// CNTP_CVAL, fires at once if already passed
+	asm volatile ("mcrr p15, 2, %0, %1, c14"
+		      :: "r" ((uint32_t)deadline), "r" ((uint32_t)(deadline >> 32)));
+	asm volatile ("mcr p15, 0, %0, c14, c2, 1" :: "r" (CNTP_CTL_ENABLE));
+	instruction_barrier();
+	IRQ::restore(flags);
+    }
+
+    void cancel_alarm(void) {
+	uint32_t flags = IRQ::save_disable();
+	asm volatile ("mcr p15, 0, %0, c14, c2, 1" :: "r" (0));
+	instruction_barrier();
+	alarms[SMP::core_id()].fn = 0;
+	IRQ::restore(flags);
+    }
+
+    void init_core(void) {
+	uint32_t cntkctl;
+	asm volatile ("mrc p15, 0, %0, c14, c1, 0" : "=r" (cntkctl));
+	cntkctl &= ~(0xF << CNTKCTL_EVNTI_SHIFT);
+	cntkctl |= CNTKCTL_EVNTEN | EVENT_BIT << CNTKCTL_EVNTI_SHIFT;
+	asm volatile ("mcr p15, 0, %0, c14, c1, 0" :: "r" (cntkctl));
+	asm volatile ("mcr p15, 0, %0, c14, c2, 1" :: "r" (0));
+	instruction_barrier();
+	IRQ::set_handler(IRQ::CNTPNS, handle_alarm, 0);
+	IRQ::enable(IRQ::CNTPNS);
+    }
+}
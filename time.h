@@ -0,0 +1,93 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Time keeping for the Raspberry Pi 2
+ *
+ * Timestamps come from the ARM generic timer, one counter shared by all
+ * cores so they are consistent between cores. The BCM system timer
+ * runs at 1MHz from power on and is available as well.
+ */
+
+#ifndef KERNEL_TIME_H
+#define KERNEL_TIME_H 1
+
+#include <stdint.h>
+
+namespace Time {
+    enum {
+	// if the firmware didn't set CNTFRQ
+	DEFAULT_FREQUENCY = 19200000,
+    };
+
+    // generic timer frequency in Hz
+    static inline uint32_t frequency(void) {
+	uint32_t freq;
+	asm volatile ("mrc p15, 0, %0, c14, c0, 0" : "=r" (freq));
+	return freq ? freq : (uint32_t)DEFAULT_FREQUENCY;
+    }
+
+    // generic timer count, monotonic
+    static inline uint64_t ticks(void) {
+	uint32_t lo, hi;
+	// don't read the counter early
+	asm volatile ("isb\n\tmrrc p15, 0, %0, %1, c14"
+		      : "=r" (lo), "=r" (hi) :: "memory");
+	return (uint64_t)hi << 32 | lo;
+    }
+
+    uint64_t ticks_to_ns(uint64_t t);
+    uint64_t ns_to_ticks(uint64_t ns);
+
+    // ns since the counter started
+    static inline uint64_t now(void) {
+	return ticks_to_ns(ticks());
+    }
+
+    // BCM system timer, us since power on
+    uint64_t system_us(void);
+
+    // busy wait, sleeps in WFE between timer events once init_core()
+    // ran
+    void delay_ns(uint64_t ns);
+    static inline void delay_us(uint32_t us) {
+	delay_ns(us * 1000ULL);
+    }
+
+    struct Timeout {
+	uint64_t deadline; // in ticks
+
+	bool expired(void) const {
+	    return ticks() >= deadline;
+	}
+    };
+
+    static inline Timeout timeout_us(uint32_t us) {
+	return Timeout{ticks() + ns_to_ticks(us * 1000ULL)};
+    }
+
+    // per core one shot alarm, runs in interrupt context
+    typedef void (*alarm_fn_t)(void *arg);
+    void set_alarm(uint64_t deadline, alarm_fn_t fn, void *arg);
+    void cancel_alarm(void);
+
+    // every core: enable the event stream and the alarm interrupt,
+    // needs IRQ::init_core()
+    void init_core(void);
+}
+
+#endif // #ifndef KERNEL_TIME_H
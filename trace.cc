@@ -0,0 +1,162 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Per-core trace buffers for the Raspberry Pi 2
+ *
+ * Decoding happens on core 0 while the others keep running, tracing is
+ * paused meanwhile so the dump doesn't trace itself.
+ */
+
+#include <stdint.h>
+#include "trace.h"
+#include "time.h"
+#include "stdio.h"
+
+namespace Trace {
+    enum {
+	MAX_COLUMNS = 100,
+    };
+
+    Buffer buffers[SMP::NUM_CORES];
+    volatile bool enabled = true;
+
+    static const char *names[NUM_EVENTS] = {
+	"frame start", "frame end", "line start", "line end",
+	"guess start", "guess end", "zoom", "work post", "work done",
+	"cancel post", "ipi receive",
+    };
+
+    // oldest event not overwritten yet
+    static uint32_t first(const Buffer &buf) {
+	return buf.head > BUFFER_SIZE ? buf.head - BUFFER_SIZE : 0;
+    }
+
+    // the last FRAME_START .. FRAME_END on core 0
+    static bool last_frame(uint32_t &start, uint32_t &end) {
+	const Buffer &buf = buffers[0];
+	bool found_end = false;
+	for (uint32_t i = buf.head; i-- > first(buf); ) {
+	    const Entry &e = buf.entries[i % BUFFER_SIZE];
+	    if (!found_end) {
+		if (e.event == FRAME_END) {
+		    end = e.stamp;
+		    found_end = true;
+		}
+	    } else if (e.event == FRAME_START) {
+		start = e.stamp;
+		return true;
+	    }
+	}
+	return false;
+    }
+
+    static uint32_t to_us(uint32_t ticks) {
+	return Time::ticks_to_ns(ticks) / 1000;
+    }
+
+    void summary(void) {
+	uint32_t start, end;
+	enabled = false;
+	if (!last_frame(start, end)) {
+	    puts("no frame traced\n");
+	    enabled = true;
+	    return;
+	}
+	uint32_t length = end - start;
+	uint32_t col_ticks = Time::frequency() / 1000;
+	if (length / col_ticks >= MAX_COLUMNS) col_ticks = length / MAX_COLUMNS + 1;
+	uint32_t columns = length / col_ticks + 1;
+	printf("frame %luus, column = %luus, L line, g guess, . other\n",
+	       to_us(length), to_us(col_ticks));
+	for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+	    const Buffer &buf = buffers[core];
+	    char state = '.';
+	    uint32_t col = 0;
+	    uint32_t last = 0;
+	    uint32_t busy[2] = {0, 0}; // line, guess
+	    uint32_t lines = 0;
+	    char row[MAX_COLUMNS + 2];
+	    for (uint32_t i = first(buf); i < buf.head; ++i) {
+		const Entry &e = buf.entries[i % BUFFER_SIZE];
+		int32_t t = e.stamp - start;
+		if (t > (int32_t)length) break;
+		if (t >= 0) {
+		    while (col < columns && col * col_ticks + col_ticks / 2 < (uint32_t)t) {
+			row[col++] = state;
+		    }
+		    if (state != '.') busy[state == 'g'] += t - last;
+		    last = t;
+		}
+		switch (e.event) {
+		case LINE_START:  state = 'L'; break;
+		case GUESS_START: state = 'g'; break;
+		case LINE_END:
+		    if (t >= 0) ++lines;
+		    state = '.';
+		    break;
+		case GUESS_END:   state = '.'; break;
+		}
+	    }
+	    while (col < columns) row[col++] = state;
+	    row[col] = 0;
+	    if (state != '.') busy[state == 'g'] += length - last;
+	    printf("core %lu |%s| %4lu lines %7luus L %6luus g\n", core, row, lines,
+		   to_us(busy[0]), to_us(busy[1]));
+	}
+	enabled = true;
+    }
+
+    void dump(void) {
+	uint32_t start, end;
+	enabled = false;
+	if (!last_frame(start, end)) {
+	    puts("no frame traced\n");
+	    enabled = true;
+	    return;
+	}
+	uint32_t next[SMP::NUM_CORES];
+	for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+	    next[core] = first(buffers[core]);
+	}
+	puts("      us core event       a          b\n");
+	while (true) {
+	    // oldest remaining event of all cores
+	    uint32_t best = SMP::NUM_CORES;
+	    int32_t best_t = 0;
+	    for (uint32_t core = 0; core < SMP::NUM_CORES; ++core) {
+		const Buffer &buf = buffers[core];
+		while (next[core] < buf.head) {
+		    int32_t t = buf.entries[next[core] % BUFFER_SIZE].stamp - start;
+		    if (t >= 0) break;
+		    ++next[core];
+		}
+		if (next[core] == buf.head) continue;
+		int32_t t = buf.entries[next[core] % BUFFER_SIZE].stamp - start;
+		if (best == SMP::NUM_CORES || t < best_t) {
+		    best = core;
+		    best_t = t;
+		}
+	    }
+	    if (best == SMP::NUM_CORES || best_t > (int32_t)(end - start)) break;
+	    const Entry &e = buffers[best].entries[next[best]++ % BUFFER_SIZE];
+	    printf("%8lu%5lu %-12s0x%08lX 0x%08lX\n", to_us(best_t), best,
+		   e.event < NUM_EVENTS ? names[e.event] : "?", e.a, e.b);
+	}
+	enabled = true;
+    }
+}
@@ -0,0 +1,88 @@
+/* Copyright (C) 2015 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Per-core trace buffers for the Raspberry Pi 2
+ *
+ * Each core writes fixed size events into its own ring without locks
+ * or barriers, old events get overwritten. An interrupt recording
+ * between the two halves of record() on the same core can cost one
+ * event, that is the price for a lock free hot path.
+ */
+
+#ifndef KERNEL_TRACE_H
+#define KERNEL_TRACE_H 1
+
+#include <stdint.h>
+#include "smp.h"
+
+namespace Trace {
+    enum {
+	BUFFER_SIZE = 2048, // events per core, power of 2
+    };
+
+    enum Event {
+	FRAME_START,	// a = step
+	FRAME_END,	// a = 1 if finished, 0 if cancelled
+	LINE_START,	// a = line
+	LINE_END,	// a = line
+	GUESS_START,	// a = step
+	GUESS_END,
+	ZOOM,		// a = key
+	WORK_POST,	// a = core
+	WORK_DONE,	// a = lines
+	CANCEL_POST,	// a = core
+	IPI_RECEIVE,	// a = type, b = from
+	NUM_EVENTS
+    };
+
+    struct Entry {
+	uint32_t stamp;	// low half of Time::ticks()
+	uint32_t event;
+	uint32_t a;
+	uint32_t b;
+    };
+
+    struct Buffer {
+	uint32_t head;	// total events written
+	Entry entries[BUFFER_SIZE];
+    };
+
+    extern Buffer buffers[SMP::NUM_CORES];
+    extern volatile bool enabled;
+
+    static inline void record(Event event, uint32_t a = 0, uint32_t b = 0) {
+	if (!enabled) return;
+	uint32_t mpidr, lo, hi;
+	asm volatile ("mrc p15, 0, %0, c0, c0, 5" : "=r" (mpidr));
+	// no ISB, the stamp may be a few cycles early
+	asm volatile ("mrrc p15, 0, %0, %1, c14" : "=r" (lo), "=r" (hi));
+	Buffer &buf = buffers[mpidr & 3];
+	Entry &e = buf.entries[buf.head++ % BUFFER_SIZE];
+	e.stamp = lo;
+	e.event = event;
+	e.a = a;
+	e.b = b;
+    }
+
+    // per core timeline of the last finished frame, one column per ms
+    void summary(void);
+    // every event of the last frame, all cores merged by time
+    void dump(void);
+}
+
+#endif // #ifndef KERNEL_TRACE_H
@@ -22,6 +22,13 @@
 #include "uart.h"
 #include "peripherals.h"
 #include "gpio.h"
+#include "sync.h"
+#include "ring.h"
+#include "smp.h"
+#include "irq.h"
+#include "barriers.h"
+#include "sched.h"
+#include "mailbox.h"
 
 namespace UART {
     enum {
@@ -89,16 +96,52 @@ namespace UART {
 	CR_UARTEN = 1 <<  0, // UART enable
 
 	// Interrupts (IMSC / RIS / MIS / ICR)
+	INT_OE  = 1 << 10, // Overrun error
+	INT_BE  = 1 <<  9, // Break error
+	INT_PE  = 1 <<  8, // Parity error
+	INT_FE  = 1 <<  7, // Framing error
+	INT_RT  = 1 <<  6, // Receive timeout
+	INT_TX  = 1 <<  5, // Transmit FIFO at or below level
+	INT_RX  = 1 <<  4, // Receive FIFO at or above level
 	INT_ALL = 0x3F3,
+
+	// Interrupt FIFO Level Select (1/8, 1/4, 1/2, 3/4, 7/8 of 16)
+	IFLS_RX_1_2 = 2 << 3,
+	IFLS_TX_1_4 = 1 << 0,
+
+	// per-core transmit ring, receive ring
+	TX_RING_SIZE = 4096,
+	RX_RING_SIZE = 1024,
+
+	// UART clock the firmware sets up and the one set_baud() asks
+	// for, 48MHz allows up to 3Mbit/s
+	BOOT_CLOCK = 3000000,
+	FAST_CLOCK = 48000000,
+	BOOT_BAUD = 115200,
+	CLOCK_ID_UART = 2,
     };
 
     constexpr volatile uint32_t * reg(uint32_t offset) {
 	return Peripherals::reg(BASE + offset);
     }
 
-    static int read_lock;
-    static int write_lock;
+    static Sync::TicketLock read_lock;
+    // held by whoever moves bytes from the rings into the FIFO
+    static Sync::TicketLock write_lock;
     static bool with_locks;
+    static bool with_irq;
+
+    // each core only ever produces into its own ring
+    static Ring<uint8_t, TX_RING_SIZE> tx_rings[SMP::NUM_CORES];
+    static Ring<uint8_t, RX_RING_SIZE> rx_ring;
+    // threads in get()
+    static Sched::WaitQueue rx_wait;
+    // ring being drained, stays put until empty so lines don't mix
+    static uint32_t current;
+    // UART clock in Hz and the current baud rate
+    static uint32_t clock;
+    static uint32_t baud;
+    static bool flow_control;
 
     // initialize uart
     void init(void) {
@@ -135,15 +178,17 @@ namespace UART {
         // Enable FIFO & 8 bit data transmission (1 stop bit, no parity)
 	*reg(LCRH) = LCRH_FEN | LCRH_WLEN8;
 
-        // Mask all interrupts.
-	*reg(IMSC) = INT_ALL;
+        // Mask all interrupts until init_irq().
+	*reg(IMSC) = 0;
 
         // Enable UART0, receive & transfer part of UART.
 	*reg(CR) = CR_UARTEN | CR_TXW | CR_RXE;
 
-	read_lock = 0;
-	write_lock = 0;
+	clock = BOOT_CLOCK;
+	baud = BOOT_BAUD;
+	flow_control = false;
 	with_locks = false;
+	with_irq = false;
     }
 
     void put_with_lock(uint8_t x) {
@@ -152,46 +197,253 @@ namespace UART {
 	*reg(DR) = x;
     }
 
+    // anything queued that fits into the FIFO?
+    static bool tx_pending(void) {
+	if (*reg(FR) & FR_TXFF) return false;
+	for (uint32_t i = 0; i < SMP::NUM_CORES; ++i) {
+	    if (!tx_rings[i].empty()) return true;
+	}
+	return false;
+    }
+
+    // move queued bytes into the FIFO until it is full, the TX
+    // interrupt continues from there
+    static void drain(void) {
+	uint32_t flags = IRQ::save_disable();
+	do {
+	    // the lock holder rechecks the rings after unlocking,
+	    // without locks only core 0 may drain
+	    if (with_locks ? !write_lock.try_lock() : SMP::core_id() != 0) {
+		break;
+	    }
+	    while(!(*reg(FR) & FR_TXFF)) {
+		uint8_t c;
+		if (tx_rings[current].pop(c)) {
+		    *reg(DR) = c;
+		    continue;
+		}
+		// next core with output
+		uint32_t i = 1;
+		while(i < SMP::NUM_CORES &&
+		      tx_rings[(current + i) % SMP::NUM_CORES].empty()) {
+		    ++i;
+		}
+		if (i == SMP::NUM_CORES) break;
+		current = (current + i) % SMP::NUM_CORES;
+	    }
+	    if (with_locks) write_lock.unlock();
+	    // order the unlock before reading the rings, pairs with
+	    // the barrier in queue()
+	    data_memory_barrier();
+	} while(tx_pending());
+	IRQ::restore(flags);
+    }
+
+    // only waits when TX_RING_SIZE bytes are already queued
+    static void queue(const char *buf, size_t len) {
+	while(len > 0) {
+	    // an interrupt handler on this core may print too, and with
+	    // IRQs on the thread may move to another core
+	    uint32_t flags = IRQ::save_disable();
+	    Ring<uint8_t, TX_RING_SIZE> &ring = tx_rings[SMP::core_id()];
+	    while(len > 0 && ring.push(*buf)) {
+		++buf;
+		--len;
+	    }
+	    IRQ::restore(flags);
+	    data_memory_barrier();
+	    drain();
+	}
+    }
+
     void put(uint8_t x) {
+	if (with_irq) {
+	    queue((const char *)&x, 1);
+	    return;
+	}
 	// aquire lock
-	if (with_locks)
-	    while(__sync_lock_test_and_set(&write_lock, 1) == 1) { }
+	if (with_locks) write_lock.lock();
 	put_with_lock(x);
 	// release lock
-	if (with_locks)
-	    __sync_lock_release(&write_lock);
+	if (with_locks) write_lock.unlock();
     }
 
     void write(const char *buf, size_t len) {
+	if (with_irq) {
+	    queue(buf, len);
+	    return;
+	}
 	// aquire lock
-	if (with_locks)
-	    while(__sync_lock_test_and_set(&write_lock, 1) == 1) { }
+	if (with_locks) write_lock.lock();
 	while(len-- > 0) {
 	    put_with_lock(*buf++);
 	}
 	// release lock
-	if (with_locks)
-	    __sync_lock_release(&write_lock);
+	if (with_locks) write_lock.unlock();
     }
 
     uint8_t get(void) {
+	uint8_t res;
+	if (with_irq && Sched::current()) {
+	    // sleep, don't hold the lock meanwhile
+	    while(true) {
+		rx_wait.wait_until([]() { return !rx_ring.empty(); });
+		if (with_locks) read_lock.lock();
+		bool got = rx_ring.pop(res);
+		if (with_locks) read_lock.unlock();
+		if (got) return res;
+	    }
+	}
 	// aquire lock
-	if (with_locks)
-	    while(__sync_lock_test_and_set(&read_lock, 1) == 1) { }
-	// wait for something in the receive buffer
-	while(*reg(FR) & FR_RXFE) { }
-	uint8_t res = *reg(DR);
+	if (with_locks) read_lock.lock();
+	if (with_irq) {
+	    while(!rx_ring.pop(res)) { }
+	} else {
+	    // wait for something in the receive buffer
+	    while(*reg(FR) & FR_RXFE) { }
+	    res = *reg(DR);
+	}
 	// release lock
-	if (with_locks)
-	    __sync_lock_release(&read_lock);
+	if (with_locks) read_lock.unlock();
 	return res;
     }
 
     bool poll(void) {
 	// any input pending?
+	if (with_irq) return !rx_ring.empty();
 	return !(*reg(FR) & FR_RXFE);
     }
 
+    static void handle_irq(uint32_t, void *) {
+	*reg(ICR) = *reg(MIS);
+	while(!(*reg(FR) & FR_RXFE)) {
+	    uint8_t c = *reg(DR);
+	    // dropped when nobody reads
+	    rx_ring.push(c);
+	}
+	if (!rx_ring.empty()) rx_wait.wake_all();
+	drain();
+    }
+
+    void init_irq(void) {
+	*reg(IFLS) = IFLS_RX_1_2 | IFLS_TX_1_4;
+	*reg(ICR) = INT_ALL;
+	IRQ::set_handler(IRQ::UART0, handle_irq, 0);
+	with_irq = true;
+	data_memory_barrier();
+	*reg(IMSC) = INT_RX | INT_RT | INT_TX;
+	IRQ::enable(IRQ::UART0);
+    }
+
+    void flush(void) {
+	while(true) {
+	    bool queued = false;
+	    for (uint32_t i = 0; i < SMP::NUM_CORES; ++i) {
+		if (!tx_rings[i].empty()) queued = true;
+	    }
+	    if (!queued && (*reg(FR) & FR_TXFE) && !(*reg(FR) & FR_BUSY)) {
+		return;
+	    }
+	    if (queued) drain();
+	}
+    }
+
+    static uint32_t set_clock(uint32_t rate) {
+	uint32_t mailbuffer[16] __attribute__((aligned(64)));
+	mailbuffer[0] = 9 * 4; // Total size
+	mailbuffer[1] = 0; // Request
+	mailbuffer[2] = 0x00038002; // Tag id (set clock rate)
+	mailbuffer[3] = 12; // Value buffer size (bytes)
+	mailbuffer[4] = 12; // Req. + value length (bytes)
+	mailbuffer[5] = CLOCK_ID_UART; // Clock id
+	mailbuffer[6] = rate; // Rate in Hz
+	mailbuffer[7] = 0; // Skip setting turbo
+	mailbuffer[8] = 0; // End tag
+
+	uint32_t *buf = Mailbox::call(Mailbox::PROPERTY, mailbuffer);
+
+	if (buf[1] != 0x80000000) return 0;
+	if (buf[5] != CLOCK_ID_UART) return 0;
+	return buf[6];
+    }
+
+    // baud rate divider in 1/64 steps, clock / (16 * rate) * 64 rounded,
+    // 0 if IBRD would be out of range
+    static uint32_t divider(uint32_t uart_clock, uint32_t rate) {
+	uint32_t div = (uint32_t)(((uint64_t)uart_clock * 4 + rate / 2) / rate);
+	if (div < 64 || div >= (65536 << 6)) return 0;
+	return div;
+    }
+
+    bool set_baud(uint32_t rate) {
+	if (rate == 0) return false;
+	// the boot clock is too slow for fast rates, the VC can raise it
+	uint32_t uart_clock = clock / 16 < rate ? (uint32_t)FAST_CLOCK : clock;
+	if (divider(uart_clock, rate) == 0) return false;
+
+	// let everything queued go out at the old rate, input arriving
+	// while the UART is off is lost
+	flush();
+	*reg(CR) = 0;
+	if (uart_clock != clock) {
+	    uint32_t got = set_clock(uart_clock);
+	    if (got != 0) clock = got;
+	}
+	uint32_t div = divider(clock, rate);
+	bool ok = div != 0;
+	if (!ok) {
+	    // the VC gave us a different clock, stay at the old rate
+	    rate = baud;
+	    div = divider(clock, rate);
+	}
+	*reg(IBRD) = div >> 6;
+	*reg(FBRD) = div & 63;
+	// the divisors only take effect with a write to LCRH
+	*reg(LCRH) = LCRH_FEN | LCRH_WLEN8;
+	*reg(CR) = CR_UARTEN | CR_TXW | CR_RXE
+	    | (flow_control ? CR_CTSEN | CR_RTSEN : 0);
+	baud = rate;
+	return ok;
+    }
+
+    void reset_clock(void) {
+	flush();
+	*reg(CR) = 0;
+	if (clock != BOOT_CLOCK) {
+	    uint32_t got = set_clock(BOOT_CLOCK);
+	    if (got != 0) clock = got;
+	}
+	// divider(BOOT_CLOCK, BOOT_BAUD) is what init() hardcodes
+	uint32_t div = divider(clock, BOOT_BAUD);
+	*reg(IBRD) = div >> 6;
+	*reg(FBRD) = div & 63;
+	*reg(LCRH) = LCRH_FEN | LCRH_WLEN8;
+	*reg(CR) = CR_UARTEN | CR_TXW | CR_RXE
+	    | (flow_control ? CR_CTSEN | CR_RTSEN : 0);
+	baud = BOOT_BAUD;
+    }
+
+    uint32_t get_baud(void) {
+	return baud;
+    }
+
+    void set_flow_control(bool on) {
+	// CTS0 and RTS0 are function 3 of GPIO 16 and 17
+	GPIO::set_function(16, on ? GPIO::FN3 : GPIO::INPUT);
+	GPIO::set_function(17, on ? GPIO::FN3 : GPIO::INPUT);
+	if (on) {
+	    *reg(CR) |= CR_CTSEN | CR_RTSEN;
+	} else {
+	    *reg(CR) &= ~(CR_CTSEN | CR_RTSEN);
+	}
+	flow_control = on;
+    }
+
+    void set_polled(void) {
+	with_irq = false;
+	data_memory_barrier();
+    }
+
     void set_with_locks(void) {
 	with_locks = true;
     }
@@ -26,12 +26,37 @@
 #include <stddef.h>
 
 namespace UART {
+    enum {
+	MIN_BAUD = 300,
+	MAX_BAUD = 3000000, // 48MHz UART clock / 16
+    };
+
     // configure UART
     void init(void);
+    // switch to buffered, interrupt driven transmit and receive, needs
+    // IRQ::init()
+    void init_irq(void);
+    // back to busy-waiting on the FIFO, for fatal errors
+    void set_polled(void);
+    // queue or send, only blocks if the calling core's ring is full
     void put(uint8_t x);
     void write(const char *buf, size_t len);
     uint8_t get(void);
     bool poll(void);
+    // wait until everything queued is sent
+    void flush(void);
+    /* Switch the baud rate after flushing, raises the UART clock to
+     * 48MHz for rates above 187500 baud. Returns false if the rate is
+     * out of range or the clock can't be set.
+     */
+    bool set_baud(uint32_t rate);
+    /* Back to the firmware's 3MHz clock and 115200 baud after flushing,
+     * for a kernel that assumes both, like init() does.
+     */
+    void reset_clock(void);
+    uint32_t get_baud(void);
+    // hardware flow control, CTS on GPIO 16 and RTS on GPIO 17
+    void set_flow_control(bool on);
     void set_with_locks(void);
 }
 